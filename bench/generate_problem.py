@@ -0,0 +1,134 @@
+#!/usr/bin/python3
+# Generates parameter files with parameterised density layouts, so that the
+# performance of neutral can be studied across mesh sizes, particle counts and
+# heterogeneity, optionally recording a neutral.tests entry from a reference
+# run of the generated problem.
+import argparse
+import os
+import random
+import re
+import subprocess
+import sys
+
+LAYOUTS = ['uniform', 'checkerboard', 'blobs', 'slabs', 'channels']
+
+def ParseArgs():
+    parser = argparse.ArgumentParser(
+        description='Generates a synthetic neutral problem')
+    parser.add_argument('output', help='the parameter file to write')
+    parser.add_argument('--layout', choices=LAYOUTS, default='checkerboard',
+        help='the arrangement of the high and low density regions')
+    parser.add_argument('--nx', type=int, default=4000)
+    parser.add_argument('--ny', type=int, default=4000)
+    parser.add_argument('--nparticles', type=int, default=1000000)
+    parser.add_argument('--iterations', type=int, default=10)
+    parser.add_argument('--dt', type=float, default=1.0e-7)
+    parser.add_argument('--initial-energy', type=float, default=1.0e4)
+    parser.add_argument('--high-density', type=float, default=1.0e4)
+    parser.add_argument('--low-density', type=float, default=1.0e-30)
+    parser.add_argument('--regions', type=int, default=8,
+        help='squares per side, blobs, slabs or channels in the layout')
+    parser.add_argument('--seed', type=int, default=1,
+        help='seeds the placement of random blobs')
+    parser.add_argument('--source', type=float, nargs=4,
+        default=[0.1, 0.1, 0.2, 0.2], metavar=('XPOS', 'YPOS', 'WIDTH',
+        'HEIGHT'), help='the source bounds as fractions of the domain')
+    parser.add_argument('--reference-binary',
+        help='runs the problem with this binary to record its neutral.tests '
+        'entry')
+    parser.add_argument('--tests', default='problems/neutral.tests',
+        help='the tests file that the reference result is recorded in')
+    return parser.parse_args()
+
+# The regions of each layout as (density, xpos, ypos, width, height) in
+# fractions of the domain, where later regions override earlier ones
+def Layout(args):
+    high, low, n = args.high_density, args.low_density, args.regions
+    regions = [(low, 0.0, 0.0, 1.0, 1.0)]
+
+    if args.layout == 'checkerboard':
+        # Alternating squares, skipping the low density squares
+        for jj in range(n):
+            for ii in range(n):
+                if (ii + jj) % 2:
+                    regions.append((high, ii / n, jj / n, 1.0 / n, 1.0 / n))
+
+    elif args.layout == 'blobs':
+        # Randomly placed and sized rectangles with varied densities
+        rng = random.Random(args.seed)
+        for bb in range(n):
+            width = rng.uniform(0.02, 0.2)
+            height = rng.uniform(0.02, 0.2)
+            density = high * 10.0**rng.uniform(-3.0, 0.0)
+            regions.append((density, rng.uniform(0.0, 1.0 - width),
+                rng.uniform(0.0, 1.0 - height), width, height))
+
+    elif args.layout == 'slabs':
+        # Horizontal layers alternating between the densities
+        for ss in range(n):
+            if ss % 2:
+                regions.append((high, 0.0, ss / n, 1.0, 1.0 / n))
+
+    elif args.layout == 'channels':
+        # A dense medium cut through by evenly spaced void channels
+        regions = [(high, 0.0, 0.0, 1.0, 1.0)]
+        width = 0.5 / n
+        for cc in range(n):
+            regions.append((low, (cc + 0.25) / n, 0.0, width, 1.0))
+
+    elif args.layout == 'uniform':
+        regions = [(high, 0.0, 0.0, 1.0, 1.0)]
+
+    return regions
+
+def WriteProblem(args):
+    lines = ['source xpos=%g ypos=%g width=%g height=%g' % tuple(args.source)]
+    regions = Layout(args)
+    for rr, (density, xpos, ypos, width, height) in enumerate(regions):
+        lines.append('problem_%d density=%.6e energy=1.0 xpos=%.6g ypos=%.6g '
+            'width=%.6g height=%.6g' % (rr, density, xpos, ypos, width,
+                height))
+    lines += [
+        'nparticles        %d' % args.nparticles,
+        'initial_energy    %g' % args.initial_energy,
+        'dt                %g' % args.dt,
+        'nx                %d' % args.nx,
+        'ny                %d' % args.ny,
+        'iterations        %d' % args.iterations,
+        'visit_dump        0',
+    ]
+    with open(args.output, 'w') as f:
+        f.write('\n'.join(lines) + '\n')
+    print('Wrote the %s problem %s with %d regions.' % (args.layout,
+        args.output, len(regions)))
+
+# Runs the problem, replacing any existing entry for it in the tests file
+def RecordReference(args):
+    output = subprocess.run([args.reference_binary, args.output],
+        stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+        universal_newlines=True).stdout
+    match = re.search(r'^Final global_energy_tally\s+(\S+)', output,
+        re.MULTILINE)
+    if not match:
+        sys.exit('The reference run of %s failed:\n%s' % (args.output,
+            output))
+
+    entries = []
+    if os.path.exists(args.tests):
+        with open(args.tests) as f:
+            entries = [l.rstrip('\n') + '\n' for l in f
+                    if l.split()[:1] != [args.output]]
+    entries.append('%s result=%s\n' % (args.output, match.group(1)))
+    with open(args.tests, 'w') as f:
+        f.writelines(entries)
+    print('Recorded %s result=%s in %s.' % (args.output, match.group(1),
+        args.tests))
+
+def Program():
+    args = ParseArgs()
+    WriteProblem(args)
+    if args.reference_binary:
+        RecordReference(args)
+
+if __name__ == '__main__':
+    Program()
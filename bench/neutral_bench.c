@@ -0,0 +1,281 @@
+#include "../../params.h"
+#include "../../shared.h"
+#include "../neutral_data.h"
+#include "../omp3/neutral.h"
+#include <math.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_NSAMPLES 4096   // Sampled particle states timed in each pass
+#define BENCH_WARMUP 5        // Untimed passes before timing a kernel
+#define BENCH_REPETITIONS 101 // Timed passes of each kernel
+#define BENCH_MASTER_KEY 101  // Master key for the sampled random numbers
+
+// The inputs shared by each of the benchmarked kernels
+typedef struct {
+  Particle* particles;
+  double* speed;
+  double* microscopic_cs_scatter;
+  double* microscopic_cs_absorb;
+  double* edgex;
+  double* edgey;
+  double number_density;
+  double inv_ntotal_particles;
+  int nx;
+  int ny;
+  uint64_t pass;
+
+  CrossSection* cs_scatter_table;
+  CrossSection* cs_absorb_table;
+  Tally* tally;
+
+} BenchState;
+
+// A kernel that performs one call for each sampled particle state, returning a
+// value that depends on every call so the work can't be eliminated
+typedef double (*BenchKernel)(BenchState* state);
+
+// Samples particle states that are representative of a problem
+void initialise_bench_state(BenchState* state, const char* params_filename);
+
+// Times a kernel over repeated passes, writing the statistics as JSON
+void time_kernel(FILE* fp, const char* name, BenchKernel kernel,
+                 BenchState* state, const int last);
+
+// Orders timings ascending
+int compare_timings(const void* a, const void* b);
+
+double bench_microscopic_cs_for_energy(BenchState* state);
+double bench_calc_distance_to_facet(BenchState* state);
+double bench_generate_random_numbers(BenchState* state);
+double bench_calculate_energy_deposition(BenchState* state);
+double bench_update_tallies(BenchState* state);
+
+// Times the transport kernels in isolation on sampled particle states
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    TERMINATE("usage: ./neutral_bench.omp3 <param_file> [output.json]\n");
+  }
+
+  const char* output_filename = (argc > 2) ? argv[2] : "bench.json";
+
+  BenchState state;
+  initialise_bench_state(&state, argv[1]);
+
+  FILE* fp = fopen(output_filename, "w");
+  if (!fp) {
+    TERMINATE("Could not open the benchmark output file: %s\n",
+              output_filename);
+  }
+
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"problem\": \"%s\",\n", argv[1]);
+  fprintf(fp, "  \"nx\": %d,\n", state.nx);
+  fprintf(fp, "  \"ny\": %d,\n", state.ny);
+  fprintf(fp, "  \"samples\": %d,\n", BENCH_NSAMPLES);
+  fprintf(fp, "  \"repetitions\": %d,\n", BENCH_REPETITIONS);
+  fprintf(fp, "  \"kernels\": [\n");
+  time_kernel(fp, "microscopic_cs_for_energy", bench_microscopic_cs_for_energy,
+              &state, 0);
+  time_kernel(fp, "calc_distance_to_facet", bench_calc_distance_to_facet,
+              &state, 0);
+  time_kernel(fp, "generate_random_numbers", bench_generate_random_numbers,
+              &state, 0);
+  time_kernel(fp, "calculate_energy_deposition",
+              bench_calculate_energy_deposition, &state, 0);
+  time_kernel(fp, "update_tallies", bench_update_tallies, &state, 1);
+  fprintf(fp, "  ]\n");
+  fprintf(fp, "}\n");
+  fclose(fp);
+
+  printf("Wrote the kernel timings to %s.\n", output_filename);
+  return EXIT_SUCCESS;
+}
+
+// Samples particle states that are representative of a problem
+void initialise_bench_state(BenchState* state, const char* params_filename) {
+  state->nx = get_int_parameter("nx", params_filename);
+  state->ny = get_int_parameter("ny", params_filename);
+  const double width = get_double_parameter("width", ARCH_ROOT_PARAMS);
+  const double height = get_double_parameter("height", ARCH_ROOT_PARAMS);
+  const double initial_energy =
+      get_double_parameter("initial_energy", params_filename);
+  const int nparticles = get_int_parameter("nparticles", params_filename);
+
+  Mesh mesh = {0};
+  mesh.rank = MASTER;
+  state->cs_scatter_table = (CrossSection*)malloc(sizeof(CrossSection));
+  state->cs_absorb_table = (CrossSection*)malloc(sizeof(CrossSection));
+  read_cs_file(CS_SCATTER_FILENAME, state->cs_scatter_table, &mesh);
+  read_cs_file(CS_CAPTURE_FILENAME, state->cs_absorb_table, &mesh);
+
+  state->tally = (Tally*)malloc(sizeof(Tally));
+  initialise_tally(state->tally, state->nx, state->ny, 1, params_filename);
+
+  // The default uniform mesh for the problem
+  state->edgex = (double*)malloc(sizeof(double) * (state->nx + 1));
+  state->edgey = (double*)malloc(sizeof(double) * (state->ny + 1));
+  for (int ii = 0; ii <= state->nx; ++ii) {
+    state->edgex[ii] = ii * (width / state->nx);
+  }
+  for (int ii = 0; ii <= state->ny; ++ii) {
+    state->edgey[ii] = ii * (height / state->ny);
+  }
+
+  state->particles = (Particle*)malloc(sizeof(Particle) * BENCH_NSAMPLES);
+  state->speed = (double*)malloc(sizeof(double) * BENCH_NSAMPLES);
+  state->microscopic_cs_scatter =
+      (double*)malloc(sizeof(double) * BENCH_NSAMPLES);
+  state->microscopic_cs_absorb =
+      (double*)malloc(sizeof(double) * BENCH_NSAMPLES);
+  state->number_density = 1.0 * AVOGADROS / MOLAR_MASS;
+  state->inv_ntotal_particles = 1.0 / nparticles;
+  state->pass = 0;
+
+  // Particles are spread across the mesh, with energies sampled
+  // logarithmically from the initial energy down to the cut off
+  for (int ii = 0; ii < BENCH_NSAMPLES; ++ii) {
+    double rn[2];
+    generate_random_numbers(ii, BENCH_MASTER_KEY, 0, &rn[0], &rn[1]);
+
+    Particle* particle = &state->particles[ii];
+    particle->x = rn[0] * width;
+    particle->y = rn[1] * height;
+    particle->cellx = (int)(rn[0] * state->nx);
+    particle->celly = (int)(rn[1] * state->ny);
+
+    generate_random_numbers(ii, BENCH_MASTER_KEY, 1, &rn[0], &rn[1]);
+    const double theta = 2.0 * M_PI * rn[0];
+    particle->omega_x = cos(theta);
+    particle->omega_y = sin(theta);
+    particle->energy =
+        MIN_ENERGY_OF_INTEREST *
+        pow(initial_energy / MIN_ENERGY_OF_INTEREST, rn[1]);
+    particle->weight = 1.0;
+    particle->dead = 0;
+
+    int cs_index = -1;
+    state->speed[ii] =
+        sqrt((2.0 * particle->energy * eV_TO_J) / PARTICLE_MASS);
+    state->microscopic_cs_scatter[ii] = microscopic_cs_for_energy(
+        state->cs_scatter_table, particle->energy, &cs_index);
+    state->microscopic_cs_absorb[ii] = microscopic_cs_for_energy(
+        state->cs_absorb_table, particle->energy, &cs_index);
+  }
+
+  // The tally is prepared as it is after the first timestep of a run, with a
+  // reproducible tally scaled to hold every deposition the passes can make,
+  // and the hot cells of a hot tally selected from an untimed pass
+  if (state->tally->mode == TALLY_REPRODUCIBLE) {
+    set_tally_fixed_point_bound(state->tally,
+                                (double)(BENCH_WARMUP + BENCH_REPETITIONS) *
+                                    BENCH_NSAMPLES * initial_energy *
+                                    state->inv_ntotal_particles);
+  } else if (state->tally->mode == TALLY_HOT) {
+    bench_update_tallies(state);
+    finalise_tally_step(state->tally);
+  }
+}
+
+// Times a kernel over repeated passes, writing the statistics as JSON
+void time_kernel(FILE* fp, const char* name, BenchKernel kernel,
+                 BenchState* state, const int last) {
+  double result = 0.0;
+  for (int ww = 0; ww < BENCH_WARMUP; ++ww) {
+    result += kernel(state);
+    state->pass++;
+  }
+
+  double timings[BENCH_REPETITIONS];
+  for (int rr = 0; rr < BENCH_REPETITIONS; ++rr) {
+    const double start = omp_get_wtime();
+    result += kernel(state);
+    timings[rr] = (omp_get_wtime() - start) * 1.0e9 / BENCH_NSAMPLES;
+    state->pass++;
+  }
+
+  qsort(timings, BENCH_REPETITIONS, sizeof(double), compare_timings);
+
+  fprintf(fp, "    {\n");
+  fprintf(fp, "      \"name\": \"%s\",\n", name);
+  fprintf(fp, "      \"calls\": %d,\n", BENCH_NSAMPLES * BENCH_REPETITIONS);
+  fprintf(fp, "      \"min_ns\": %.3f,\n", timings[0]);
+  fprintf(fp, "      \"median_ns\": %.3f,\n", timings[BENCH_REPETITIONS / 2]);
+  fprintf(fp, "      \"p90_ns\": %.3f,\n",
+          timings[(int)(0.9 * (BENCH_REPETITIONS - 1))]);
+  fprintf(fp, "      \"p99_ns\": %.3f,\n",
+          timings[(int)(0.99 * (BENCH_REPETITIONS - 1))]);
+  fprintf(fp, "      \"max_ns\": %.3f,\n", timings[BENCH_REPETITIONS - 1]);
+  fprintf(fp, "      \"checksum\": %.6e\n", result);
+  fprintf(fp, "    }%s\n", (last) ? "" : ",");
+}
+
+// Orders timings ascending
+int compare_timings(const void* a, const void* b) {
+  const double diff = *(const double*)a - *(const double*)b;
+  return (diff > 0.0) - (diff < 0.0);
+}
+
+double bench_microscopic_cs_for_energy(BenchState* state) {
+  double result = 0.0;
+  for (int ii = 0; ii < BENCH_NSAMPLES; ++ii) {
+    int cs_index = -1;
+    result += microscopic_cs_for_energy(
+        state->cs_scatter_table, state->particles[ii].energy, &cs_index);
+  }
+  return result;
+}
+
+double bench_calc_distance_to_facet(BenchState* state) {
+  double result = 0.0;
+  for (int ii = 0; ii < BENCH_NSAMPLES; ++ii) {
+    Particle* particle = &state->particles[ii];
+    int x_facet = 0;
+    double distance_to_facet = 0.0;
+    calc_distance_to_facet(state->nx, particle->x, particle->y, 0, 0, 0,
+                           particle->omega_x, particle->omega_y,
+                           state->speed[ii], particle->cellx, particle->celly,
+                           &distance_to_facet, &x_facet, state->edgex,
+                           state->edgey);
+    result += distance_to_facet + x_facet;
+  }
+  return result;
+}
+
+double bench_generate_random_numbers(BenchState* state) {
+  double result = 0.0;
+  for (int ii = 0; ii < BENCH_NSAMPLES; ++ii) {
+    double rn[2];
+    generate_random_numbers(ii, BENCH_MASTER_KEY, state->pass, &rn[0],
+                            &rn[1]);
+    result += rn[0] + rn[1];
+  }
+  return result;
+}
+
+double bench_calculate_energy_deposition(BenchState* state) {
+  double result = 0.0;
+  for (int ii = 0; ii < BENCH_NSAMPLES; ++ii) {
+    const double microscopic_cs_total =
+        state->microscopic_cs_scatter[ii] + state->microscopic_cs_absorb[ii];
+    result += calculate_energy_deposition(
+        state->nx, state->nx, 0, 0, &state->particles[ii],
+        state->inv_ntotal_particles, state->speed[ii] * 1.0e-9,
+        state->number_density, state->microscopic_cs_absorb[ii],
+        microscopic_cs_total);
+  }
+  return result;
+}
+
+double bench_update_tallies(BenchState* state) {
+  for (int ii = 0; ii < BENCH_NSAMPLES; ++ii) {
+    Particle* particle = &state->particles[ii];
+    update_tallies(0, 0, particle->cellx, particle->celly,
+                   state->inv_ntotal_particles, particle->energy,
+                   state->tally);
+  }
+  flush_tally(state->tally);
+  return 0.0;
+}
@@ -0,0 +1,205 @@
+#!/usr/bin/python3
+# Runs the neutral problems over a range of thread counts, recording the
+# throughput and memory of each run to JSON, printing strong and weak scaling
+# tables and optionally flagging regressions against a baseline results file.
+import argparse
+import glob
+import json
+import os
+import re
+import statistics
+import subprocess
+import sys
+import tempfile
+
+def ParseArgs():
+    parser = argparse.ArgumentParser(
+        description="Benchmarks the neutral problems over thread counts")
+    parser.add_argument('--binary', default='./neutral.omp3',
+        help='the neutral binary to benchmark')
+    parser.add_argument('--problems', nargs='+',
+        default=sorted(glob.glob('problems/*.params')),
+        help='the parameter files to run')
+    parser.add_argument('--threads', type=int, nargs='+',
+        default=DefaultThreads(), help='the OpenMP thread counts to run')
+    parser.add_argument('--repetitions', type=int, default=3,
+        help='the runs of each configuration, the median is reported')
+    parser.add_argument('--scales', type=float, nargs='+', default=[1.0],
+        help='multiples of each problem\'s particle count to run')
+    parser.add_argument('--iterations', type=int,
+        help='overrides the number of iterations of each problem')
+    parser.add_argument('--weak', action='store_true',
+        help='also scale the particle count with the threads for weak scaling')
+    parser.add_argument('--output', default='bench_results.json',
+        help='where to write the JSON results')
+    parser.add_argument('--baseline',
+        help='a previous JSON results file to check for regressions against')
+    parser.add_argument('--threshold', type=float, default=0.05,
+        help='the fractional throughput drop that counts as a regression')
+    return parser.parse_args()
+
+# Powers of two up to the number of cores
+def DefaultThreads():
+    threads = [1]
+    while threads[-1] * 2 <= os.cpu_count():
+        threads.append(threads[-1] * 2)
+    if threads[-1] != os.cpu_count():
+        threads.append(os.cpu_count())
+    return threads
+
+# Writes a copy of a parameter file with an overridden particle count and
+# number of iterations
+def ScaleProblem(problem, scale, iterations, directory):
+    with open(problem) as f:
+        lines = f.readlines()
+
+    nparticles = 0
+    scaled = []
+    for line in lines:
+        tokens = line.split()
+        if tokens and tokens[0] == 'nparticles':
+            nparticles = max(1, int(round(int(tokens[1]) * scale)))
+            line = 'nparticles %d\n' % nparticles
+        elif tokens and tokens[0] == 'iterations' and iterations:
+            line = 'iterations %d\n' % iterations
+        scaled.append(line)
+
+    # Unmodified problems are run in place so that they are still validated
+    if scale == 1.0 and not iterations:
+        return problem, nparticles
+
+    path = os.path.join(directory, '%s_x%g.params' %
+            (os.path.splitext(os.path.basename(problem))[0], scale))
+    with open(path, 'w') as f:
+        f.writelines(scaled)
+    return path, nparticles
+
+# Runs a single configuration, parsing the statistics that main.c reports
+def RunProblem(binary, params, threads):
+    env = dict(os.environ, OMP_NUM_THREADS=str(threads))
+    process = subprocess.Popen([binary, params], env=env,
+            stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+            universal_newlines=True)
+    output = process.stdout.read()
+    _, status, usage = os.wait4(process.pid, 0)
+    process.returncode = os.waitstatus_to_exitcode(status)
+    if process.returncode != 0:
+        sys.exit('%s failed with %d threads:\n%s' % (params, threads, output))
+
+    def Values(pattern, cast):
+        return [cast(v) for v in re.findall(pattern, output, re.MULTILINE)]
+
+    wallclock = Values(r'^Final Wallclock\s+([0-9.eE+-]+)s', float)[0]
+    facets = sum(Values(r'^Facets\s+(\d+)', int))
+    collisions = sum(Values(r'^Collisions\s+(\d+)', int))
+    particles = sum(Values(r'^Particles\s+(\d+)', int))
+    allocated = Values(r'^Allocated\s+([0-9.]+)GB', float)
+    return {
+        'wallclock_s': wallclock,
+        'facets': facets,
+        'collisions': collisions,
+        'events_per_s': (facets + collisions) / wallclock,
+        'particles_per_s': particles / wallclock,
+        'allocated_gb': allocated[0] if allocated else 0.0,
+        'max_rss_gb': usage.ru_maxrss / 1024.0**2,
+        'passed': 'PASSED validation' in output,
+    }
+
+# Runs every repetition of a configuration, keeping the median run
+def Benchmark(args, problem, params, nparticles, scale, threads, mode):
+    runs = [RunProblem(args.binary, params, threads)
+            for rr in range(args.repetitions)]
+    median = sorted(runs, key=lambda r: r['wallclock_s'])[len(runs) // 2]
+    result = dict(median, problem=problem, scale=scale, threads=threads,
+            mode=mode, nparticles=nparticles,
+            wallclock_runs_s=[r['wallclock_s'] for r in runs],
+            wallclock_stdev_s=statistics.pstdev(
+                [r['wallclock_s'] for r in runs]))
+    print('%-24s %-6s x%-6g %4d threads %10.4fs %10.3e events/s' %
+            (problem, mode, scale, threads, result['wallclock_s'],
+                result['events_per_s']))
+    return result
+
+def Key(result):
+    return (result['problem'], result['mode'], result['scale'],
+            result['threads'])
+
+# Prints the speedup and parallel efficiency against the smallest thread count
+def PrintScaling(results, mode):
+    print('\n%s scaling' % ('Strong' if mode == 'strong' else 'Weak'))
+    print('%-24s %6s %8s %12s %10s %10s' % ('problem', 'scale', 'threads',
+        'wallclock', 'speedup', 'efficiency'))
+    groups = {}
+    for result in results:
+        if result['mode'] == mode:
+            groups.setdefault((result['problem'], result['scale']),
+                    []).append(result)
+    for (problem, scale), group in sorted(groups.items()):
+        group.sort(key=lambda r: r['threads'])
+        base = group[0]
+        for result in group:
+            ratio = base['wallclock_s'] / result['wallclock_s']
+            if mode == 'strong':
+                speedup = ratio
+                efficiency = ratio * base['threads'] / result['threads']
+            else:
+                speedup = ratio * result['threads'] / base['threads']
+                efficiency = ratio
+            print('%-24s %6g %8d %11.4fs %10.2f %9.1f%%' % (problem, scale,
+                result['threads'], result['wallclock_s'], speedup,
+                100.0 * efficiency))
+
+# Flags any configuration whose throughput dropped by more than the threshold
+def CompareBaseline(results, baseline_file, threshold):
+    with open(baseline_file) as f:
+        baseline = {Key(r): r for r in json.load(f)['results']}
+
+    print('\nComparison against %s' % baseline_file)
+    nregressions = 0
+    for result in results:
+        if Key(result) not in baseline:
+            continue
+        expected = baseline[Key(result)]['events_per_s']
+        change = result['events_per_s'] / expected - 1.0
+        regressed = change < -threshold
+        nregressions += regressed
+        print('%-24s %-6s x%-6g %4d threads %+7.1f%% %s' % (result['problem'],
+            result['mode'], result['scale'], result['threads'],
+            100.0 * change, 'REGRESSION' if regressed else ''))
+    print('%d regression(s) above %.1f%%' % (nregressions, 100.0 * threshold))
+    return nregressions
+
+def Program():
+    args = ParseArgs()
+    results = []
+    with tempfile.TemporaryDirectory() as directory:
+        for problem in args.problems:
+            for scale in args.scales:
+                params, nparticles = ScaleProblem(problem, scale,
+                        args.iterations, directory)
+                for threads in args.threads:
+                    results.append(Benchmark(args, problem, params,
+                        nparticles, scale, threads, 'strong'))
+
+                # Keep the particles per thread constant for weak scaling
+                for threads in args.threads if args.weak else []:
+                    weak_scale = scale * threads / args.threads[0]
+                    params, nparticles = ScaleProblem(problem, weak_scale,
+                            args.iterations, directory)
+                    results.append(Benchmark(args, problem, params,
+                        nparticles, scale, threads, 'weak'))
+
+    with open(args.output, 'w') as f:
+        json.dump({'binary': args.binary, 'results': results}, f, indent=2)
+    print('\nWrote %d results to %s' % (len(results), args.output))
+
+    PrintScaling(results, 'strong')
+    if args.weak:
+        PrintScaling(results, 'weak')
+
+    if args.baseline and CompareBaseline(results, args.baseline,
+            args.threshold):
+        sys.exit(1)
+
+if __name__ == '__main__':
+    Program()
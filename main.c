@@ -88,31 +88,67 @@ int main(int argc, char** argv) {
       printf("\nIteration  %d\n", tt);
     }
 
+    // The first timestep tracks the particles injected at initialisation
+    if (neutral_data.inject_each_step && tt > 1) {
+      const double inject_begin = trace_time();
+      begin_perf_phase(neutral_data.perf);
+      reinject_particles(
+          neutral_data.nparticles, (uint64_t)(tt - 1) * neutral_data.nparticles,
+          mesh.global_nx, mesh.local_nx - 2 * mesh.pad,
+          mesh.local_ny - 2 * mesh.pad, mesh.pad, neutral_data.local_source_x,
+          neutral_data.local_source_y, neutral_data.local_source_width,
+          neutral_data.local_source_height, mesh.x_off, mesh.y_off, mesh.dt,
+          mesh.edgex, mesh.edgey, neutral_data.initial_energy,
+          neutral_data.free_slots, &neutral_data.nlocal_particles,
+          neutral_data.local_particles);
+      end_perf_phase(neutral_data.perf, PERF_PHASE_INJECT);
+      trace_event(neutral_data.tracer, "inject_particles", inject_begin,
+                  trace_time());
+    }
+
     if (visit_dump) {
+      const double dump_begin = trace_time();
+      begin_perf_phase(neutral_data.perf);
       plot_particle_density(&neutral_data, &mesh, tt, neutral_data.nparticles,
                             elapsed_sim_time);
+      end_perf_phase(neutral_data.perf, PERF_PHASE_OUTPUT);
+      trace_event(neutral_data.tracer, "plot_particle_density", dump_begin,
+                  trace_time());
     }
 
     uint64_t facet_events = 0;
     uint64_t collision_events = 0;
      
+    const double step_begin = trace_time();
     START_PROFILING(&profile);
+    begin_perf_phase(neutral_data.perf);
     // Begin the main solve step
-    solve_transport_2d(
+    const int nlive = solve_transport_2d(
         mesh.local_nx - 2 * mesh.pad, mesh.local_ny - 2 * mesh.pad,
         mesh.global_nx, mesh.global_ny, tt, mesh.pad, mesh.x_off, mesh.y_off,
         mesh.dt, neutral_data.nparticles, &neutral_data.nlocal_particles,
         mesh.neighbours, neutral_data.local_particles,
         shared_data.density, mesh.edgex, mesh.edgey, mesh.edgedx, mesh.edgedy,
         neutral_data.cs_scatter_table, neutral_data.cs_absorb_table,
-        neutral_data.energy_deposition_tally, neutral_data.nfacets_reduce_array,
-        neutral_data.ncollisions_reduce_array, neutral_data.nprocessed_reduce_array,
+        neutral_data.regions, neutral_data.tally,
+        neutral_data.variance_reduction, neutral_data.schedule,
+        neutral_data.counters, neutral_data.tracer,
+        neutral_data.nfacets_reduce_array,
+        neutral_data.ncollisions_reduce_array,
+        neutral_data.nprocessed_reduce_array,
         &facet_events, &collision_events);
+    end_perf_phase(neutral_data.perf, PERF_PHASE_TRANSPORT);
 
     barrier();
-    
+
+    const double tally_begin = trace_time();
+    finalise_tally_step(neutral_data.tally);
+    trace_event(neutral_data.tracer, "finalise_tally_step", tally_begin,
+                trace_time());
+
     const char p = '0' + tt;
     STOP_PROFILING(&profile, &p);
+    trace_event(neutral_data.tracer, "timestep", step_begin, trace_time());
     double step_time = profile.profiler_entries[tt-1].time;
     wallclock += step_time;
     printf("Step time  %.4fs\n", step_time);
@@ -123,6 +159,7 @@ int main(int argc, char** argv) {
     // Note that this metric is only valid in the single event case
     printf("Facet Events / s %.2e\n", facet_events / step_time);
     printf("Collision Events / s %.2e\n", collision_events / step_time);
+    print_perf_step(neutral_data.perf);
 
     elapsed_sim_time += mesh.dt;
 
@@ -130,12 +167,30 @@ int main(int argc, char** argv) {
       char tally_name[100];
       sprintf(tally_name, "energy%d", tt);
       int dneighbours[NNEIGHBOURS] = {EDGE, EDGE, EDGE, EDGE, EDGE, EDGE};
+
+      // The tally is written out at its own, potentially coarser, resolution
+      const double dump_begin = trace_time();
+      begin_perf_phase(neutral_data.perf);
+      Tally* tally = neutral_data.tally;
       write_all_ranks_to_visit(
-          mesh.global_nx, mesh.global_ny, mesh.local_nx - 2 * mesh.pad,
-          mesh.local_ny - 2 * mesh.pad, mesh.pad, mesh.x_off, mesh.y_off,
-          mesh.rank, mesh.nranks, dneighbours,
-          neutral_data.energy_deposition_tally, tally_name, 0,
-          elapsed_sim_time);
+          (mesh.global_nx * tally->nx) / tally->mesh_nx,
+          (mesh.global_ny * tally->ny) / tally->mesh_ny, tally->nx, tally->ny,
+          mesh.pad, (mesh.x_off * tally->nx) / tally->mesh_nx,
+          (mesh.y_off * tally->ny) / tally->mesh_ny, mesh.rank, mesh.nranks,
+          dneighbours, gather_tally(tally), tally_name, 0, elapsed_sim_time);
+      end_perf_phase(neutral_data.perf, PERF_PHASE_OUTPUT);
+      trace_event(neutral_data.tracer, "write_tally_to_visit", dump_begin,
+                  trace_time());
+    }
+
+    // Leave the simulation once every particle has died, unless the source
+    // will inject more
+    if (!neutral_data.inject_each_step && reduce_all_sum(nlive) == 0.0) {
+      if (mesh.rank == MASTER)
+        printf("No particles are left alive, ending the run after %d of %d "
+               "timesteps\n",
+               tt, mesh.niters);
+      break;
     }
 
     // Leave the simulation if we have reached the simulation end time
@@ -146,14 +201,20 @@ int main(int argc, char** argv) {
     }
   }
 
+  begin_perf_phase(neutral_data.perf);
   if (visit_dump) {
     plot_particle_density(&neutral_data, &mesh, tt, neutral_data.nparticles,
                           elapsed_sim_time);
   }
 
-  validate(mesh.local_nx - 2 * mesh.pad, mesh.local_ny - 2 * mesh.pad,
-           neutral_data.neutral_params_filename, mesh.rank,
-           neutral_data.energy_deposition_tally);
+  // The tally is gathered so that every cell can be validated
+  Tally* tally = neutral_data.tally;
+  validate(tally->nx, tally->ny, neutral_data.neutral_params_filename,
+           mesh.rank, gather_tally(tally));
+  generate_weight_windows(neutral_data.variance_reduction, tally->nx,
+                          tally->ny, gather_tally(tally), mesh.local_nx,
+                          mesh.local_ny, mesh.pad, shared_data.density);
+  end_perf_phase(neutral_data.perf, PERF_PHASE_OUTPUT);
 
   if (mesh.rank == MASTER) {
     //PRINT_PROFILING_RESULTS(&p);
@@ -162,6 +223,12 @@ int main(int argc, char** argv) {
     printf("Elapsed Simulation Time %.6fs\n", elapsed_sim_time);
   }
 
+  print_batch_statistics(neutral_data.tally, wallclock);
+
+  print_perf_totals(neutral_data.perf);
+
+  write_trace(neutral_data.tracer);
+
   return 0;
 }
 
@@ -0,0 +1,151 @@
+#include "neutral_counters.h"
+#include "../params.h"
+#include "../shared.h"
+#include "neutral_data.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Initialises the event counters from the parameter file
+size_t initialise_event_counters(EventCounters* counters, const int nthreads,
+                                 const char* params_filename) {
+  counters->nthreads = nthreads;
+  counters->enabled =
+      get_optional_int_parameter("event_counters", params_filename, 0);
+  counters->cycle_sample_interval =
+      get_optional_int_parameter("event_counter_cycles", params_filename, 0);
+  counters->counts = NULL;
+  counters->history_stats = NULL;
+
+  size_t allocation = 0;
+  if (get_optional_int_parameter("history_stats", params_filename, 0)) {
+    counters->history_stats =
+        (uint64_t*)calloc(nthreads * HISTORY_STRIDE, sizeof(uint64_t));
+    if (!counters->history_stats) {
+      TERMINATE("Could not allocate the history statistics.\n");
+    }
+    allocation += sizeof(uint64_t) * nthreads * HISTORY_STRIDE;
+  }
+
+  if (!counters->enabled) {
+    return allocation;
+  }
+
+  if (counters->cycle_sample_interval && !CYCLE_COUNTER_AVAILABLE) {
+    printf("Cycle sampling is not supported on this processor.\n");
+    counters->cycle_sample_interval = 0;
+  }
+
+  counters->counts =
+      (uint64_t*)calloc(nthreads * EVENT_COUNTER_STRIDE, sizeof(uint64_t));
+  if (!counters->counts) {
+    TERMINATE("Could not allocate the event counters.\n");
+  }
+
+  return allocation + sizeof(uint64_t) * nthreads * EVENT_COUNTER_STRIDE;
+}
+
+// Prints a summary of the events counted by every thread, and resets them
+void print_event_counters(EventCounters* counters) {
+  if (!counters->enabled) {
+    return;
+  }
+
+  uint64_t totals[NEVENT_COUNTERS] = {0};
+  for (int tt = 0; tt < counters->nthreads; ++tt) {
+    uint64_t* thread_counts = &counters->counts[tt * EVENT_COUNTER_STRIDE];
+    for (int cc = 0; cc < NEVENT_COUNTERS; ++cc) {
+      totals[cc] += thread_counts[cc];
+      thread_counts[cc] = 0;
+    }
+  }
+
+  printf("Histories  %" PRIu64 "\n", totals[COUNT_HISTORIES]);
+  printf("Facet events %" PRIu64 ", collision events %" PRIu64 "\n",
+         totals[COUNT_FACETS], totals[COUNT_COLLISIONS]);
+  printf("Census events %" PRIu64 ", deaths %" PRIu64 "\n",
+         totals[COUNT_CENSUS], totals[COUNT_DEATHS]);
+  printf("CS lookups %" PRIu64 ", average search depth %.2f\n",
+         totals[COUNT_CS_LOOKUPS],
+         (totals[COUNT_CS_LOOKUPS])
+             ? (double)totals[COUNT_CS_SEARCH_STEPS] / totals[COUNT_CS_LOOKUPS]
+             : 0.0);
+  printf("RNG draws  %" PRIu64 "\n", totals[COUNT_RNG_DRAWS]);
+  printf("Tally atomics %" PRIu64 "\n", totals[COUNT_TALLY_ATOMICS]);
+  if (counters->cycle_sample_interval) {
+    printf("Cycles per history %.0f, from %" PRIu64 " samples\n",
+           (totals[COUNT_SAMPLED_HISTORIES])
+               ? (double)totals[COUNT_SAMPLED_CYCLES] /
+                     totals[COUNT_SAMPLED_HISTORIES]
+               : 0.0,
+           totals[COUNT_SAMPLED_HISTORIES]);
+  }
+}
+
+// Finds the upper bound of the histogram bin holding a percentile
+static uint64_t history_percentile(const uint64_t* bins, const uint64_t total,
+                                   const double percentile) {
+  uint64_t cumulative = 0;
+  for (int bb = 0; bb < HISTORY_BINS; ++bb) {
+    cumulative += bins[bb];
+    if (cumulative >= percentile * total) {
+      return UINT64_C(1) << bb;
+    }
+  }
+  return UINT64_C(1) << (HISTORY_BINS - 1);
+}
+
+// Prints the percentiles and non-empty bins of a history histogram
+static void print_history_histogram(const char* name, const char* unit,
+                                    const double scale, const uint64_t* bins,
+                                    const uint64_t total, const uint64_t sum,
+                                    const uint64_t max) {
+  printf("History %s mean %.3g%s, p50 < %.3g%s, p99 < %.3g%s, max %.3g%s\n",
+         name, (double)sum / total * scale, unit,
+         history_percentile(bins, total, 0.5) * scale, unit,
+         history_percentile(bins, total, 0.99) * scale, unit, max * scale,
+         unit);
+  for (int bb = 0; bb < HISTORY_BINS; ++bb) {
+    if (bins[bb]) {
+      printf("  [%9.3g, %9.3g)%s %12" PRIu64 " %6.2f%%\n",
+             ((bb) ? (double)(UINT64_C(1) << (bb - 1)) : 0.0) * scale,
+             (double)(UINT64_C(1) << bb) * scale, unit, bins[bb],
+             100.0 * bins[bb] / total);
+    }
+  }
+}
+
+// Prints the distribution of the cost of each history, and resets it
+void print_history_stats(EventCounters* counters) {
+  if (!counters->history_stats) {
+    return;
+  }
+
+  uint64_t totals[HISTORY_STRIDE] = {0};
+  for (int tt = 0; tt < counters->nthreads; ++tt) {
+    uint64_t* stats = &counters->history_stats[tt * HISTORY_STRIDE];
+    for (int ss = 0; ss < HISTORY_STRIDE; ++ss) {
+      if (ss == HISTORY_MAX_EVENTS || ss == HISTORY_MAX_NS) {
+        totals[ss] = (stats[ss] > totals[ss]) ? stats[ss] : totals[ss];
+      } else {
+        totals[ss] += stats[ss];
+      }
+      stats[ss] = 0;
+    }
+  }
+
+  uint64_t nhistories = 0;
+  for (int bb = 0; bb < HISTORY_BINS; ++bb) {
+    nhistories += totals[bb];
+  }
+  if (!nhistories) {
+    return;
+  }
+
+  print_history_histogram("events", "", 1.0, totals, nhistories,
+                          totals[HISTORY_SUM_EVENTS],
+                          totals[HISTORY_MAX_EVENTS]);
+  print_history_histogram("time", "us", 1.0e-3, &totals[HISTORY_BINS],
+                          nhistories, totals[HISTORY_SUM_NS],
+                          totals[HISTORY_MAX_NS]);
+}
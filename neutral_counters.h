@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(__CUDACC__)
+#include <x86intrin.h>
+#define CYCLE_COUNTER_AVAILABLE 1
+#else
+#define CYCLE_COUNTER_AVAILABLE 0
+#endif
+
+/* Event Counter Constants */
+#define EVENT_COUNTER_STRIDE 16                   // Pads thread's counters
+#define HISTORY_BINS 40                           // Power of two bins
+#define HISTORY_MAX_EVENTS (2 * HISTORY_BINS)     // Most events in a history
+#define HISTORY_MAX_NS (2 * HISTORY_BINS + 1)     // Longest history in ns
+#define HISTORY_SUM_EVENTS (2 * HISTORY_BINS + 2) // Events in all histories
+#define HISTORY_SUM_NS (2 * HISTORY_BINS + 3)     // Time in all histories
+#define HISTORY_STRIDE (2 * HISTORY_BINS + 8)     // Pads thread's statistics
+
+// The events that are counted by each thread
+enum {
+  COUNT_HISTORIES,
+  COUNT_FACETS,
+  COUNT_COLLISIONS,
+  COUNT_CENSUS,
+  COUNT_DEATHS,
+  COUNT_CS_LOOKUPS,
+  COUNT_CS_SEARCH_STEPS,
+  COUNT_RNG_DRAWS,
+  COUNT_TALLY_ATOMICS,
+  COUNT_SAMPLED_HISTORIES,
+  COUNT_SAMPLED_CYCLES,
+  NEVENT_COUNTERS
+};
+
+// Represents the per-thread event counters, which are summarised each step
+typedef struct {
+  uint64_t* counts; // EVENT_COUNTER_STRIDE counters for each thread
+  int nthreads;
+  int enabled;
+
+  // The number of histories between each history that has its cycles
+  // sampled, or 0 when cycle sampling is disabled
+  int cycle_sample_interval;
+
+  // Power of two histograms of the events and nanoseconds taken by each
+  // history, followed by their maximums and sums, or NULL when not recorded
+  uint64_t* history_stats;
+
+} EventCounters;
+
+// Initialises the event counters from the parameter file
+size_t initialise_event_counters(EventCounters* counters, const int nthreads,
+                                 const char* params_filename);
+
+// Prints a summary of the events counted by every thread, and resets them
+void print_event_counters(EventCounters* counters);
+
+// Prints the distribution of the cost of each history, and resets it
+void print_history_stats(EventCounters* counters);
+
+// Reads the processor's cycle counter
+static inline uint64_t read_cycle_counter(void) {
+#if CYCLE_COUNTER_AVAILABLE
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+// Records the events and time taken by a history in a thread's histograms,
+// where bin b holds values in [2^(b-1), 2^b)
+static inline void record_history(uint64_t* stats, const uint64_t nevents,
+                                  const uint64_t ns) {
+  const int event_bin = (nevents) ? 64 - __builtin_clzll(nevents) : 0;
+  const int ns_bin = (ns) ? 64 - __builtin_clzll(ns) : 0;
+  stats[(event_bin < HISTORY_BINS) ? event_bin : HISTORY_BINS - 1]++;
+  stats[HISTORY_BINS + ((ns_bin < HISTORY_BINS) ? ns_bin : HISTORY_BINS - 1)]++;
+  stats[HISTORY_SUM_EVENTS] += nevents;
+  stats[HISTORY_SUM_NS] += ns;
+  if (nevents > stats[HISTORY_MAX_EVENTS]) {
+    stats[HISTORY_MAX_EVENTS] = nevents;
+  }
+  if (ns > stats[HISTORY_MAX_NS]) {
+    stats[HISTORY_MAX_NS] = ns;
+  }
+}
@@ -6,15 +6,19 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define max(a, b) (((a) > (b)) ? (a) : (b))
 
-// Reads a cross section file
-void read_cs_file(const char* filename, CrossSection* cs, Mesh* mesh);
-
 // Initialises the set of cross sections
 void initialise_cross_sections(NeutralData* neutral_data, Mesh* mesh);
 
+// Initialises the constant density regions from the problem entries
+void initialise_regions(NeutralData* neutral_data, Mesh* mesh);
+
+// Finds the largest density of any of the problem entries
+double max_problem_density(const char* params_filename);
+
 // Initialises all of the neutral-specific data structures.
 void initialise_neutral_data(NeutralData* neutral_data, Mesh* mesh) {
   const int pad = mesh->pad;
@@ -94,8 +98,72 @@ void initialise_neutral_data(NeutralData* neutral_data, Mesh* mesh) {
   // Rounding hack to make sure correct number of particles is selected
   neutral_data->nlocal_particles = nlocal_particles_real + 0.5;
 
-  size_t allocation = allocate_data(&neutral_data->energy_deposition_tally,
-                                    local_nx * local_ny);
+  neutral_data->local_source_x = local_particle_left_off;
+  neutral_data->local_source_y = local_particle_bottom_off;
+  neutral_data->local_source_width = local_particle_width;
+  neutral_data->local_source_height = local_particle_height;
+  neutral_data->inject_each_step = get_optional_int_parameter(
+      "inject_each_step", neutral_data->neutral_params_filename, 0);
+
+  neutral_data->tally = (Tally*)malloc(sizeof(Tally));
+  if (!neutral_data->tally) {
+    TERMINATE("Could not allocate the energy deposition tally.\n");
+  }
+
+  size_t allocation =
+      initialise_tally(neutral_data->tally, local_nx, local_ny,
+                       neutral_data->nthreads,
+                       neutral_data->neutral_params_filename);
+
+  neutral_data->variance_reduction =
+      (VarianceReduction*)malloc(sizeof(VarianceReduction));
+  if (!neutral_data->variance_reduction) {
+    TERMINATE("Could not allocate the variance reduction.\n");
+  }
+  allocation += initialise_variance_reduction(
+      neutral_data->variance_reduction, local_nx, local_ny,
+      neutral_data->neutral_params_filename);
+
+  neutral_data->schedule = (Schedule*)malloc(sizeof(Schedule));
+  if (!neutral_data->schedule) {
+    TERMINATE("Could not allocate the history schedule.\n");
+  }
+  allocation += initialise_schedule(
+      neutral_data->schedule, neutral_data->nthreads,
+      PARTICLE_BANK_FACTOR * neutral_data->nparticles,
+      neutral_data->initial_energy, neutral_data->neutral_params_filename);
+
+  neutral_data->counters = (EventCounters*)malloc(sizeof(EventCounters));
+  if (!neutral_data->counters) {
+    TERMINATE("Could not allocate the event counters.\n");
+  }
+  allocation += initialise_event_counters(
+      neutral_data->counters, neutral_data->nthreads,
+      neutral_data->neutral_params_filename);
+
+  neutral_data->tracer = (Tracer*)malloc(sizeof(Tracer));
+  if (!neutral_data->tracer) {
+    TERMINATE("Could not allocate the tracer.\n");
+  }
+  allocation += initialise_tracer(neutral_data->tracer, neutral_data->nthreads,
+                                  mesh->rank,
+                                  neutral_data->neutral_params_filename);
+
+  neutral_data->perf = (PerfCounters*)malloc(sizeof(PerfCounters));
+  if (!neutral_data->perf) {
+    TERMINATE("Could not allocate the hardware counters.\n");
+  }
+  allocation += initialise_perf_counters(
+      neutral_data->perf, neutral_data->nthreads,
+      neutral_data->neutral_params_filename);
+
+  // The free list can hold every slot of the particle bank
+  neutral_data->free_slots = NULL;
+  if (neutral_data->inject_each_step) {
+    allocation +=
+        allocate_int_data(&neutral_data->free_slots,
+                          PARTICLE_BANK_FACTOR * neutral_data->nparticles);
+  }
 
   allocation += allocate_uint64_data(&neutral_data->nfacets_reduce_array,
                                      neutral_data->nparticles);
@@ -106,17 +174,45 @@ void initialise_neutral_data(NeutralData* neutral_data, Mesh* mesh) {
 
   // Inject some particles into the mesh if we need to
   if (neutral_data->nlocal_particles) {
+    const double inject_begin = trace_time();
+    begin_perf_phase(neutral_data->perf);
     allocation += inject_particles(
         neutral_data->nparticles, mesh->global_nx, mesh->local_nx,
         mesh->local_ny, pad, local_particle_left_off, local_particle_bottom_off,
         local_particle_width, local_particle_height, mesh->x_off, mesh->y_off,
         mesh->dt, mesh->edgex, mesh->edgey, neutral_data->initial_energy,
         &neutral_data->local_particles);
+    end_perf_phase(neutral_data->perf, PERF_PHASE_INJECT);
+    trace_event(neutral_data->tracer, "inject_particles", inject_begin,
+                trace_time());
   }
 
   printf("Allocated %.4fGB of data.\n", allocation / GB);
 
   initialise_cross_sections(neutral_data, mesh);
+
+  // The fixed point tally is scaled by an upper bound on the deposition into
+  // a cell, from every particle depositing its initial energy over the
+  // largest number of mean free paths it could travel in each timestep
+  if (neutral_data->tally->mode == TALLY_REPRODUCIBLE) {
+    const double max_macroscopic_cs =
+        (neutral_data->cs_scatter_table->max_value +
+         neutral_data->cs_absorb_table->max_value) *
+        BARNS * max_problem_density(neutral_data->neutral_params_filename) *
+        AVOGADROS / MOLAR_MASS;
+    const double max_speed =
+        sqrt((2.0 * neutral_data->initial_energy * eV_TO_J) / PARTICLE_MASS);
+    set_tally_fixed_point_bound(
+        neutral_data->tally, mesh->niters * neutral_data->initial_energy *
+                                 max_macroscopic_cs * max_speed * mesh->dt);
+  }
+
+  // Optionally track particles against region boundaries, rather than facets
+  neutral_data->regions = NULL;
+  if (get_optional_int_parameter(
+          "csg_geometry", neutral_data->neutral_params_filename, 0)) {
+    initialise_regions(neutral_data, mesh);
+  }
 }
 
 // Reads in a cross-sectional data file
@@ -165,6 +261,11 @@ void read_cs_file(const char* filename, CrossSection* cs, Mesh* mesh) {
     fscanf(fp, "%lf", &h_values[ii]);
   }
 
+  cs->max_value = 0.0;
+  for (int ii = 0; ii < cs->nentries; ++ii) {
+    cs->max_value = max(cs->max_value, h_values[ii]);
+  }
+
   move_host_buffer_to_device(cs->nentries, &h_keys, &cs->keys);
   move_host_buffer_to_device(cs->nentries, &h_values, &cs->values);
 }
@@ -176,3 +277,139 @@ void initialise_cross_sections(NeutralData* neutral_data, Mesh* mesh) {
   read_cs_file(CS_SCATTER_FILENAME, neutral_data->cs_scatter_table, mesh);
   read_cs_file(CS_CAPTURE_FILENAME, neutral_data->cs_absorb_table, mesh);
 }
+
+// Initialises the constant density regions from the problem entries
+void initialise_regions(NeutralData* neutral_data, Mesh* mesh) {
+  Regions* regions = (Regions*)malloc(sizeof(Regions));
+  if (!regions) {
+    TERMINATE("Could not allocate the region geometry.\n");
+  }
+
+  char* keys = (char*)malloc(sizeof(char) * MAX_KEYS * MAX_STR_LEN);
+  double* values = (double*)malloc(sizeof(double) * MAX_KEYS);
+
+  // Count the problem entries, which are numbered contiguously from zero
+  int nkeys = 0;
+  char specifier[MAX_STR_LEN];
+  regions->nregions = 0;
+  while (1) {
+    sprintf(specifier, "problem_%d", regions->nregions);
+    if (!get_key_value_parameter(specifier,
+                                 neutral_data->neutral_params_filename, keys,
+                                 values, &nkeys)) {
+      break;
+    }
+    regions->nregions++;
+  }
+
+  if (!regions->nregions) {
+    TERMINATE("Parameter file %s did not contain any problem entries.\n",
+              neutral_data->neutral_params_filename);
+  }
+
+  allocate_host_data(&regions->xpos, regions->nregions);
+  allocate_host_data(&regions->ypos, regions->nregions);
+  allocate_host_data(&regions->width, regions->nregions);
+  allocate_host_data(&regions->height, regions->nregions);
+  allocate_host_data(&regions->density, regions->nregions);
+
+  for (int rr = 0; rr < regions->nregions; ++rr) {
+    sprintf(specifier, "problem_%d", rr);
+    get_key_value_parameter(specifier, neutral_data->neutral_params_filename,
+                            keys, values, &nkeys);
+
+    // The last four keys are the bound specification
+    regions->xpos[rr] = values[nkeys - 4] * mesh->width;
+    regions->ypos[rr] = values[nkeys - 3] * mesh->height;
+    regions->width[rr] = values[nkeys - 2] * mesh->width;
+    regions->height[rr] = values[nkeys - 1] * mesh->height;
+
+    regions->density[rr] = 0.0;
+    for (int kk = 0; kk < nkeys - 4; ++kk) {
+      if (strcmp(&keys[kk * MAX_STR_LEN], "density") == 0) {
+        regions->density[rr] = values[kk];
+      }
+    }
+  }
+
+  regions->domain_width = mesh->width;
+  regions->domain_height = mesh->height;
+  neutral_data->regions = regions;
+
+  if (mesh->rank == MASTER) {
+    printf("Tracking particles against %d region(s).\n", regions->nregions);
+  }
+
+  free(keys);
+  free(values);
+}
+
+// Finds the largest density of any of the problem entries
+double max_problem_density(const char* params_filename) {
+  char* keys = (char*)malloc(sizeof(char) * MAX_KEYS * MAX_STR_LEN);
+  double* values = (double*)malloc(sizeof(double) * MAX_KEYS);
+
+  int nkeys = 0;
+  char specifier[MAX_STR_LEN];
+  double max_density = 0.0;
+  for (int rr = 0;; ++rr) {
+    sprintf(specifier, "problem_%d", rr);
+    if (!get_key_value_parameter(specifier, params_filename, keys, values,
+                                 &nkeys)) {
+      break;
+    }
+    for (int kk = 0; kk < nkeys - 4; ++kk) {
+      if (strcmp(&keys[kk * MAX_STR_LEN], "density") == 0) {
+        max_density = max(max_density, values[kk]);
+      }
+    }
+  }
+
+  free(keys);
+  free(values);
+  return max_density;
+}
+
+// Fetches the value of a parameter that may be omitted from the parameter file
+int get_optional_parameter(const char* param_name, const char* filename,
+                           char* value) {
+  FILE* fp = fopen(filename, "r");
+  if (!fp) {
+    TERMINATE("Could not open the parameter file: %s\n", filename);
+  }
+
+  int found = 0;
+  char line[MAX_STR_LEN];
+  char name[MAX_STR_LEN];
+  while (fgets(line, MAX_STR_LEN, fp)) {
+    if (sscanf(line, "%s %s", name, value) == 2 &&
+        strcmp(name, param_name) == 0) {
+      found = 1;
+      break;
+    }
+  }
+
+  fclose(fp);
+  return found;
+}
+
+// Fetches an integer parameter that may be omitted from the parameter file
+int get_optional_int_parameter(const char* param_name, const char* filename,
+                               const int default_value) {
+  char value[MAX_STR_LEN];
+  if (!get_optional_parameter(param_name, filename, value)) {
+    return default_value;
+  }
+  return atoi(value);
+}
+
+// Fetches a double parameter that may be omitted from the parameter file
+double get_optional_double_parameter(const char* param_name,
+                                     const char* filename,
+                                     const double default_value) {
+  char value[MAX_STR_LEN];
+  if (!get_optional_parameter(param_name, filename, value)) {
+    return default_value;
+  }
+  return atof(value);
+}
@@ -5,6 +5,12 @@
 
 #include "../comms.h"
 #include "../mesh.h"
+#include "neutral_counters.h"
+#include "neutral_perf.h"
+#include "neutral_schedule.h"
+#include "neutral_tally.h"
+#include "neutral_trace.h"
+#include "neutral_variance.h"
 #include "rand.h"
 
 #if 0
@@ -21,6 +27,9 @@
 #define MASS_NO 1.0e2                    // Mass num of the particle
 #define MOLAR_MASS 1.0e-2                // Dummy kg per mole
 #define MIN_ENERGY_OF_INTEREST 1.0e0     // Energy to kill particles
+#define PARTICLE_BANK_FACTOR 2           // Bank capacity per source particle
+#define SECONDARY_STAGING_SIZE 32        // Bank slots reserved per thread
+#define MIN_PARTICLES_PER_THREAD 64      // Smallest share of a sweep
 #define OPEN_BOUND_CORRECTION 1.0e-13    // Fixes open bounds
 #define TAG_SEND_RECV 100
 #define TAG_PARTICLE 1
@@ -32,16 +41,39 @@
 #define ARCH_ROOT_PARAMS "../arch.params"
 #define NEUTRAL_TESTS "problems/neutral.tests"
 
-enum { PARTICLE_SENT, PARTICLE_DEAD, PARTICLE_CENSUS, PARTICLE_CONTINUE };
+enum {
+  PARTICLE_SENT,
+  PARTICLE_DEAD,
+  PARTICLE_CENSUS,
+  PARTICLE_CONTINUE,
+  PARTICLE_SUSPENDED
+};
 
 // Represents a cross sectional table for resonance data
 typedef struct {
   double* keys;
   double* values;
   int nentries;
+  double max_value; // largest cross section in the table
 
 } CrossSection;
 
+// Represents the rectangular regions of constant density described by the
+// problem entries, used when tracking against region boundaries
+typedef struct {
+  double* xpos;
+  double* ypos;
+  double* width;
+  double* height;
+  double* density;
+  int nregions;
+
+  // The extent of the problem domain, where particles are reflected
+  double domain_width;
+  double domain_height;
+
+} Regions;
+
 #ifdef SoA
 
 // Represents an individual particle
@@ -75,6 +107,15 @@ typedef struct {
   int cellx;               // x position in mesh
   int celly;               // y position in mesh
   int dead;                // particle is dead
+  uint64_t key;            // the key of the particle's random number stream
+
+  // Transport state cached at census for the next timestep, where an index
+  // of -1 marks a particle that has not been tracked yet
+  double speed;                  // speed at the particle's energy
+  double microscopic_cs_scatter; // scatter cross section at the energy
+  double microscopic_cs_absorb;  // absorb cross section at the energy
+  int scatter_cs_index;          // energy group of the scatter cross section
+  int absorb_cs_index;           // energy group of the absorb cross section
 
 } Particle;
 
@@ -86,14 +127,31 @@ typedef struct {
   CrossSection* cs_absorb_table;
   Particle* local_particles;
 
+  // Only set when particles are tracked against region boundaries
+  Regions* regions;
+
   double initial_energy;
 
   int nthreads;
   int nparticles;
   int nlocal_particles;
 
+  // When set, the source injects its particles again at the start of each
+  // timestep after the first, into the slots freed by dead particles
+  int inject_each_step;
+  int* free_slots;
+  double local_source_x;
+  double local_source_y;
+  double local_source_width;
+  double local_source_height;
+
   double* scalar_flux_tally;
-  double* energy_deposition_tally;
+  Tally* tally;
+  VarianceReduction* variance_reduction;
+  Schedule* schedule;
+  EventCounters* counters;
+  Tracer* tracer;
+  PerfCounters* perf;
 
   const char* neutral_params_filename;
 
@@ -113,4 +171,20 @@ MPI_Datatype particle_type;
 // Initialises all of the Neutral-specific data structures.
 void initialise_neutral_data(NeutralData* bright_data, Mesh* mesh);
 
+// Reads a cross section file
+void read_cs_file(const char* filename, CrossSection* cs, Mesh* mesh);
+
+// Fetches the value of a parameter that may be omitted from the parameter file
+int get_optional_parameter(const char* param_name, const char* filename,
+                           char* value);
+
+// Fetches an integer parameter that may be omitted from the parameter file
+int get_optional_int_parameter(const char* param_name, const char* filename,
+                               const int default_value);
+
+// Fetches a double parameter that may be omitted from the parameter file
+double get_optional_double_parameter(const char* param_name,
+                                     const char* filename,
+                                     const double default_value);
+
 #endif
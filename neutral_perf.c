@@ -0,0 +1,249 @@
+#include "neutral_perf.h"
+#include "../params.h"
+#include "../shared.h"
+#include "neutral_data.h"
+#include <errno.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if PERF_COUNTERS_AVAILABLE
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const char* perf_event_names[NPERF_EVENTS] = {
+    "cycles", "instructions", "cache misses", "dTLB misses", "branch misses"};
+
+static const char* perf_phase_names[NPERF_PHASES] = {"inject", "transport",
+                                                     "output"};
+
+#if PERF_COUNTERS_AVAILABLE
+// Opens a user space counter on the calling thread as part of a group
+static int open_perf_event(const int event, const int group_fd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  switch (event) {
+    case PERF_CYCLES:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case PERF_INSTRUCTIONS:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case PERF_CACHE_MISSES:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CACHE_MISSES;
+      break;
+    case PERF_DTLB_MISSES:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      break;
+    case PERF_BRANCH_MISSES:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+      break;
+  }
+
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+#endif
+
+// Opens the hardware counters on each thread if requested by the parameter
+// file, disabling them if the system does not allow them
+size_t initialise_perf_counters(PerfCounters* perf, const int nthreads,
+                                const char* params_filename) {
+  perf->nthreads = nthreads;
+  perf->enabled =
+      get_optional_int_parameter("perf_counters", params_filename, 0);
+  perf->fds = NULL;
+  perf->begin = NULL;
+  perf->step = NULL;
+  perf->totals = NULL;
+
+  if (!perf->enabled) {
+    return 0;
+  }
+
+#if PERF_COUNTERS_AVAILABLE
+  perf->fds = (int*)malloc(sizeof(int) * nthreads * NPERF_EVENTS);
+  perf->begin = (uint64_t*)calloc(nthreads * PERF_STRIDE, sizeof(uint64_t));
+  perf->step = (uint64_t*)calloc(NPERF_PHASES * NPERF_EVENTS, sizeof(uint64_t));
+  perf->totals =
+      (uint64_t*)calloc(NPERF_PHASES * NPERF_EVENTS, sizeof(uint64_t));
+  if (!perf->fds || !perf->begin || !perf->step || !perf->totals) {
+    TERMINATE("Could not allocate the hardware counters.\n");
+  }
+
+  // The counters only count the thread that opens them, which relies on the
+  // OpenMP runtime keeping the same threads in each parallel region
+  int nfailed = 0;
+  int error = 0;
+#pragma omp parallel reduction(+ : nfailed)
+  {
+    int* fds = &perf->fds[omp_get_thread_num() * NPERF_EVENTS];
+    fds[PERF_CYCLES] = open_perf_event(PERF_CYCLES, -1);
+    if (fds[PERF_CYCLES] == -1) {
+      nfailed++;
+#pragma omp atomic write
+      error = errno;
+    }
+
+    // Unsupported members are skipped so the rest of the group is reported
+    for (int ee = PERF_CYCLES + 1; ee < NPERF_EVENTS; ++ee) {
+      fds[ee] = (fds[PERF_CYCLES] == -1)
+                    ? -1
+                    : open_perf_event(ee, fds[PERF_CYCLES]);
+    }
+  }
+
+  if (nfailed) {
+    printf("Hardware counters are unavailable (%s), continuing without "
+           "them.\n",
+           strerror(error));
+    for (int ii = 0; ii < nthreads * NPERF_EVENTS; ++ii) {
+      if (perf->fds[ii] != -1) {
+        close(perf->fds[ii]);
+      }
+    }
+    perf->enabled = 0;
+    return 0;
+  }
+
+  for (int ee = 0; ee < NPERF_EVENTS; ++ee) {
+    if (perf->fds[ee] == -1) {
+      printf("The %s hardware counter is not supported.\n",
+             perf_event_names[ee]);
+    }
+  }
+
+  return sizeof(uint64_t) * nthreads * PERF_STRIDE;
+#else
+  printf("Hardware counters are only supported on Linux, continuing without "
+         "them.\n");
+  perf->enabled = 0;
+  return 0;
+#endif
+}
+
+#if PERF_COUNTERS_AVAILABLE
+// Reads the current values of the calling thread's counters
+static void read_perf_events(PerfCounters* perf, uint64_t* values) {
+  const int* fds = &perf->fds[omp_get_thread_num() * NPERF_EVENTS];
+  for (int ee = 0; ee < NPERF_EVENTS; ++ee) {
+    values[ee] = 0;
+    if (fds[ee] != -1 &&
+        read(fds[ee], &values[ee], sizeof(uint64_t)) != sizeof(uint64_t)) {
+      values[ee] = 0;
+    }
+  }
+}
+#endif
+
+// Reads each thread's counters at the start of a phase
+void begin_perf_phase(PerfCounters* perf) {
+  if (!perf->enabled) {
+    return;
+  }
+
+#if PERF_COUNTERS_AVAILABLE
+#pragma omp parallel
+  {
+    read_perf_events(perf,
+                     &perf->begin[omp_get_thread_num() * PERF_STRIDE]);
+  }
+#endif
+}
+
+// Attributes the events counted by each thread since the start of the phase
+void end_perf_phase(PerfCounters* perf, const int phase) {
+  if (!perf->enabled) {
+    return;
+  }
+
+#if PERF_COUNTERS_AVAILABLE
+  uint64_t* step = &perf->step[phase * NPERF_EVENTS];
+#pragma omp parallel
+  {
+    uint64_t values[NPERF_EVENTS];
+    read_perf_events(perf, values);
+    const uint64_t* begin = &perf->begin[omp_get_thread_num() * PERF_STRIDE];
+    for (int ee = 0; ee < NPERF_EVENTS; ++ee) {
+#pragma omp atomic update
+      step[ee] += values[ee] - begin[ee];
+    }
+  }
+#endif
+}
+
+// Prints the events counted in one phase
+static void print_perf_phase(PerfCounters* perf, const char* label,
+                             const uint64_t* counts) {
+  printf("%s cycles %.3e, IPC %.2f", label, (double)counts[PERF_CYCLES],
+         (counts[PERF_CYCLES])
+             ? (double)counts[PERF_INSTRUCTIONS] / counts[PERF_CYCLES]
+             : 0.0);
+  for (int ee = PERF_CACHE_MISSES; ee < NPERF_EVENTS; ++ee) {
+    if (perf->fds[ee] != -1) {
+      printf(", %s %.3e", perf_event_names[ee], (double)counts[ee]);
+    }
+  }
+  printf("\n");
+}
+
+// Prints the events counted in each phase since the last summary
+void print_perf_step(PerfCounters* perf) {
+  if (!perf->enabled) {
+    return;
+  }
+
+  for (int pp = 0; pp < NPERF_PHASES; ++pp) {
+    uint64_t* step = &perf->step[pp * NPERF_EVENTS];
+    if (!step[PERF_CYCLES]) {
+      continue;
+    }
+
+    char label[32];
+    snprintf(label, sizeof(label), "HW %s", perf_phase_names[pp]);
+    print_perf_phase(perf, label, step);
+
+    for (int ee = 0; ee < NPERF_EVENTS; ++ee) {
+      perf->totals[pp * NPERF_EVENTS + ee] += step[ee];
+      step[ee] = 0;
+    }
+  }
+}
+
+// Prints the events counted in each phase over the whole run, and closes the
+// counters
+void print_perf_totals(PerfCounters* perf) {
+  if (!perf->enabled) {
+    return;
+  }
+
+  print_perf_step(perf);
+
+  for (int pp = 0; pp < NPERF_PHASES; ++pp) {
+    char label[32];
+    snprintf(label, sizeof(label), "Final HW %s", perf_phase_names[pp]);
+    print_perf_phase(perf, label, &perf->totals[pp * NPERF_EVENTS]);
+  }
+
+#if PERF_COUNTERS_AVAILABLE
+  for (int ii = 0; ii < perf->nthreads * NPERF_EVENTS; ++ii) {
+    if (perf->fds[ii] != -1) {
+      close(perf->fds[ii]);
+    }
+  }
+#endif
+  perf->enabled = 0;
+}
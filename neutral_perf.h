@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__linux__) && !defined(__CUDACC__)
+#define PERF_COUNTERS_AVAILABLE 1
+#else
+#define PERF_COUNTERS_AVAILABLE 0
+#endif
+
+/* Hardware Counter Constants */
+#define PERF_STRIDE 16 // Pads each thread's counter values to cache lines
+
+// The hardware events counted by each thread, where cycles lead the group
+enum {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_CACHE_MISSES,
+  PERF_DTLB_MISSES,
+  PERF_BRANCH_MISSES,
+  NPERF_EVENTS
+};
+
+// The phases of the application that the hardware events are attributed to
+enum {
+  PERF_PHASE_INJECT,
+  PERF_PHASE_TRANSPORT,
+  PERF_PHASE_OUTPUT,
+  NPERF_PHASES
+};
+
+// Represents a group of hardware counters opened on each OpenMP thread, which
+// are read at the start and end of each phase
+typedef struct {
+  int* fds;          // NPERF_EVENTS descriptors per thread, -1 if unsupported
+  uint64_t* begin;   // PERF_STRIDE values per thread at the start of a phase
+  uint64_t* step;    // NPERF_EVENTS totals per phase since the last summary
+  uint64_t* totals;  // NPERF_EVENTS totals per phase over the whole run
+  int nthreads;
+  int enabled;
+
+} PerfCounters;
+
+// Opens the hardware counters on each thread if requested by the parameter
+// file, disabling them if the system does not allow them
+size_t initialise_perf_counters(PerfCounters* perf, const int nthreads,
+                                const char* params_filename);
+
+// Reads each thread's counters at the start of a phase
+void begin_perf_phase(PerfCounters* perf);
+
+// Attributes the events counted by each thread since the start of the phase
+void end_perf_phase(PerfCounters* perf, const int phase);
+
+// Prints the events counted in each phase since the last summary
+void print_perf_step(PerfCounters* perf);
+
+// Prints the events counted in each phase over the whole run, and closes the
+// counters
+void print_perf_totals(PerfCounters* perf);
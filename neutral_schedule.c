@@ -0,0 +1,240 @@
+#include "neutral_schedule.h"
+#include "../params.h"
+#include "../shared.h"
+#include "neutral_data.h"
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Orders the bins by their predicted cost, largest first
+static const double* sorted_bin_cost = NULL;
+static int compare_bin_cost(const void* a, const void* b) {
+  const double cost_a = sorted_bin_cost[*(const int*)a];
+  const double cost_b = sorted_bin_cost[*(const int*)b];
+  return (cost_a < cost_b) - (cost_a > cost_b);
+}
+
+// Initialises the history scheduling from the parameter file
+size_t initialise_schedule(Schedule* schedule, const int nthreads,
+                           const int capacity, const double initial_energy,
+                           const char* params_filename) {
+  schedule->lpt =
+      get_optional_int_parameter("lpt_schedule", params_filename, 0);
+  schedule->chunk = get_optional_int_parameter("schedule_chunk",
+                                               params_filename, SCHEDULE_CHUNK);
+  schedule->lockstep =
+      get_optional_int_parameter("lockstep_histories", params_filename, 0);
+  schedule->interleave = get_optional_int_parameter(
+      "interleaved_histories", params_filename,
+      (schedule->lockstep) ? LOCKSTEP_LANES : 1);
+  schedule->nthreads = nthreads;
+  schedule->capacity = capacity;
+  schedule->order = NULL;
+  schedule->bins = NULL;
+  schedule->bin_cost = NULL;
+  schedule->thread_sums = NULL;
+  schedule->distance_map = NULL;
+  schedule->max_density = 0.0;
+  schedule->min_energy = MIN_ENERGY_OF_INTEREST;
+  schedule->energy_scale =
+      COST_ENERGY_BINS / log(initial_energy / MIN_ENERGY_OF_INTEREST);
+  schedule->event_budget = get_optional_int_parameter("history_event_budget",
+                                                      params_filename, 0);
+  schedule->suspended = NULL;
+  schedule->suspended_head = 0;
+  schedule->suspended_tail = 0;
+  schedule->nworking = 0;
+
+  if (schedule->chunk < 1) {
+    TERMINATE("The schedule_chunk must be positive.\n");
+  }
+  if (schedule->interleave < 1 ||
+      schedule->interleave > MAX_INTERLEAVE) {
+    TERMINATE("The interleaved_histories must be between 1 and %d.\n",
+              MAX_INTERLEAVE);
+  }
+  if (schedule->lockstep && schedule->interleave < 2) {
+    TERMINATE("The lockstep_histories need 2 or more interleaved_histories.\n");
+  }
+  if (schedule->lockstep) {
+    printf("Tracking %d histories in lockstep on each thread.\n",
+           schedule->interleave);
+  } else if (schedule->interleave > 1) {
+    printf("Interleaving %d histories on each thread.\n",
+           schedule->interleave);
+  }
+  if (schedule->event_budget < 0) {
+    TERMINATE("The history_event_budget must not be negative.\n");
+  }
+
+  // Each particle is suspended at most once at a time, so the ring can hold
+  // every suspended history of a sweep
+  size_t allocation = 0;
+  if (schedule->event_budget) {
+    schedule->suspended =
+        (SuspendedHistory*)malloc(sizeof(SuspendedHistory) * capacity);
+    if (!schedule->suspended) {
+      TERMINATE("Could not allocate the suspended histories.\n");
+    }
+    for (int ii = 0; ii < capacity; ++ii) {
+      schedule->suspended[ii].sequence = ii;
+    }
+    allocation += sizeof(SuspendedHistory) * capacity;
+
+    printf("Suspending histories after %d events for idle threads to resume.\n",
+           schedule->event_budget);
+  }
+
+  if (!schedule->lpt) {
+    return allocation;
+  }
+
+  schedule->order = (int*)malloc(sizeof(int) * capacity);
+  schedule->bins = (int*)malloc(sizeof(int) * capacity);
+  schedule->bin_cost = (double*)malloc(sizeof(double) * COST_NBINS);
+  schedule->thread_sums =
+      (double*)calloc(nthreads * COST_STRIDE, sizeof(double));
+  schedule->distance_map =
+      (int*)malloc(sizeof(int) * COST_MAP_BLOCKS * COST_MAP_BLOCKS);
+  if (!schedule->order || !schedule->bins || !schedule->bin_cost ||
+      !schedule->thread_sums || !schedule->distance_map) {
+    TERMINATE("Could not allocate the history schedule.\n");
+  }
+  for (int bb = 0; bb < COST_NBINS; ++bb) {
+    schedule->bin_cost[bb] = -1.0;
+  }
+
+  printf("Ordering histories by predicted cost, claimed in chunks of %d.\n",
+         schedule->chunk);
+
+  return allocation + sizeof(int) * 2 * capacity +
+         sizeof(double) * (COST_NBINS + nthreads * COST_STRIDE) +
+         sizeof(int) * COST_MAP_BLOCKS * COST_MAP_BLOCKS;
+}
+
+// Builds the map of the distance to the nearest dense block from the density
+// of the transport mesh
+void build_distance_map(Schedule* schedule, const int nx, const int ny,
+                        const int pad, const double* density) {
+
+  // Find the largest density in each block of the map
+  double block_density[COST_MAP_BLOCKS * COST_MAP_BLOCKS];
+  memset(block_density, 0, sizeof(block_density));
+  for (int ii = 0; ii < ny; ++ii) {
+    for (int jj = 0; jj < nx; ++jj) {
+      const int block = ((ii * COST_MAP_BLOCKS) / ny) * COST_MAP_BLOCKS +
+                        (jj * COST_MAP_BLOCKS) / nx;
+      const double d = density[(ii + pad) * (nx + 2 * pad) + (jj + pad)];
+      if (d > block_density[block]) {
+        block_density[block] = d;
+      }
+      if (d > schedule->max_density) {
+        schedule->max_density = d;
+      }
+    }
+  }
+
+  // The distance is measured in blocks along the furthest axis, and is
+  // capped at the last distance bin
+  const double dense = COST_DENSE_FRACTION * schedule->max_density;
+  for (int by = 0; by < COST_MAP_BLOCKS; ++by) {
+    for (int bx = 0; bx < COST_MAP_BLOCKS; ++bx) {
+      int distance = COST_DISTANCE_BINS - 1;
+      for (int oy = 0; oy < COST_MAP_BLOCKS; ++oy) {
+        for (int ox = 0; ox < COST_MAP_BLOCKS; ++ox) {
+          if (block_density[oy * COST_MAP_BLOCKS + ox] >= dense) {
+            const int dx = abs(ox - bx);
+            const int dy = abs(oy - by);
+            const int d = (dx > dy) ? dx : dy;
+            distance = (d < distance) ? d : distance;
+          }
+        }
+      }
+      schedule->distance_map[by * COST_MAP_BLOCKS + bx] = distance;
+    }
+  }
+}
+
+// Orders the slots by the predicted cost of their bins, largest first, with
+// the dead slots last
+void order_by_cost(Schedule* schedule, const int nslots) {
+
+  // Bins that have never been seen are predicted to cost the most, so that
+  // they are not left until last
+  int bin_order[COST_NBINS];
+  double cost[COST_NBINS];
+  for (int bb = 0; bb < COST_NBINS; ++bb) {
+    bin_order[bb] = bb;
+    cost[bb] =
+        (schedule->bin_cost[bb] < 0.0) ? DBL_MAX : schedule->bin_cost[bb];
+  }
+  sorted_bin_cost = cost;
+  qsort(bin_order, COST_NBINS, sizeof(int), compare_bin_cost);
+
+  // A counting sort places the slots of each bin after the costlier bins
+  int offsets[COST_NBINS + 1];
+  memset(offsets, 0, sizeof(offsets));
+  for (int pp = 0; pp < nslots; ++pp) {
+    if (schedule->bins[pp] >= 0) {
+      offsets[schedule->bins[pp] + 1]++;
+    }
+  }
+
+  int offset = 0;
+  for (int bb = 0; bb < COST_NBINS; ++bb) {
+    const int bin = bin_order[bb];
+    const int count = offsets[bin + 1];
+    offsets[bin + 1] = offset;
+    offset += count;
+  }
+
+  int dead_offset = offset;
+  for (int pp = 0; pp < nslots; ++pp) {
+    const int bin = schedule->bins[pp];
+    schedule->order[(bin < 0) ? dead_offset++ : offsets[bin + 1]++] = pp;
+  }
+}
+
+// Prints the accuracy of this timestep's predictions, and learns the cost of
+// each bin from its histories
+void update_cost_model(Schedule* schedule) {
+  if (!schedule->lpt) {
+    return;
+  }
+
+  double sums[COST_STRIDE];
+  memset(sums, 0, sizeof(sums));
+  for (int tt = 0; tt < schedule->nthreads; ++tt) {
+    double* thread_sums = &schedule->thread_sums[tt * COST_STRIDE];
+    for (int ii = 0; ii < COST_STRIDE; ++ii) {
+      sums[ii] += thread_sums[ii];
+      thread_sums[ii] = 0.0;
+    }
+  }
+
+  // The correlation between the predicted and actual events of a history
+  const double n = sums[COST_SUM_N];
+  if (n > 1.0) {
+    const double cov =
+        n * sums[COST_SUM_XY] - sums[COST_SUM_X] * sums[COST_SUM_Y];
+    const double var_x =
+        n * sums[COST_SUM_XX] - sums[COST_SUM_X] * sums[COST_SUM_X];
+    const double var_y =
+        n * sums[COST_SUM_YY] - sums[COST_SUM_Y] * sums[COST_SUM_Y];
+    printf("Cost prediction correlation %.3f, total bias %+.1f%% over %.0f "
+           "histories\n",
+           (var_x > 0.0 && var_y > 0.0) ? cov / sqrt(var_x * var_y) : 0.0,
+           (sums[COST_SUM_Y] > 0.0)
+               ? 100.0 * (sums[COST_SUM_X] - sums[COST_SUM_Y]) /
+                     sums[COST_SUM_Y]
+               : 0.0,
+           n);
+  }
+
+  for (int bb = 0; bb < COST_NBINS; ++bb) {
+    if (sums[2 * bb + 1] > 0.0) {
+      schedule->bin_cost[bb] = sums[2 * bb] / sums[2 * bb + 1];
+    }
+  }
+}
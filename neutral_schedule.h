@@ -0,0 +1,133 @@
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* History Scheduling Constants */
+#define SCHEDULE_CHUNK 16       // Default histories claimed at once
+#define MAX_INTERLEAVE 16       // Most histories a thread keeps in flight
+#define LOCKSTEP_LANES 8        // Default histories tracked in lockstep
+#define COST_DENSITY_BINS 8     // Bins of four decades below the max density
+#define COST_DISTANCE_BINS 8    // Bins of map blocks to the nearest dense one
+#define COST_ENERGY_BINS 8      // Log bins between the cut off and source
+#define COST_NBINS (COST_DENSITY_BINS * COST_DISTANCE_BINS * COST_ENERGY_BINS)
+#define COST_MAP_BLOCKS 32      // Blocks per side of the dense region map
+#define COST_DENSE_FRACTION 0.1 // Fraction of the max density that is dense
+#define COST_STRIDE (2 * COST_NBINS + 8) // Pads thread's statistics
+
+// The sums that the accuracy of the predictions is measured from, which are
+// held after the events and histories of each bin
+enum {
+  COST_SUM_N = 2 * COST_NBINS,
+  COST_SUM_X,
+  COST_SUM_Y,
+  COST_SUM_XX,
+  COST_SUM_YY,
+  COST_SUM_XY
+};
+
+// A history that was suspended when it used its event budget, holding the
+// state that is not kept in the particle
+typedef struct {
+  int64_t sequence; // the position in the ring that the entry is ready for
+  int pid;
+  uint64_t counter; // the next draw of the particle's random number stream
+  uint64_t nevents; // the events taken by the history so far
+  double seconds;   // the time taken by the history so far
+} SuspendedHistory;
+
+// Schedules the histories of each timestep, optionally tracking those with
+// the largest predicted cost first. The cost of a history is predicted from
+// a bin of its starting state, the density of its cell, the distance to
+// the nearest dense region and its energy, whose events are learned from
+// the histories of the previous timestep
+typedef struct {
+  int lpt;   // order histories largest predicted cost first
+  int chunk;      // histories each thread claims at once
+  int interleave; // histories each thread keeps in flight
+  int lockstep;   // find the next facets of the histories in flight together
+  int nthreads;
+
+  int* order; // the slots of the first sweep, in the order they are tracked
+  int* bins;  // the cost bin of each slot, or -1 if the particle is dead
+  int capacity;
+
+  double* bin_cost;    // predicted events of each bin, or -1 if never seen
+  double* thread_sums; // COST_STRIDE statistics for each thread
+
+  // The number of map blocks from each block to the nearest dense block,
+  // built from the density on the first timestep
+  int* distance_map;
+  double max_density;
+
+  // Scales the log of the energy above the cut off into the energy bins
+  double min_energy;
+  double energy_scale;
+
+  // Histories that use their event budget in a sweep are suspended in a ring,
+  // and resumed by the threads that have finished their own histories, so
+  // that a few long histories do not hold up the end of the sweep
+  int event_budget; // events before a history is suspended, or 0
+  SuspendedHistory* suspended;
+  int64_t suspended_head;
+  int64_t suspended_tail;
+  int nworking; // threads that may still suspend a history
+
+} Schedule;
+
+// Initialises the history scheduling from the parameter file
+size_t initialise_schedule(Schedule* schedule, const int nthreads,
+                           const int capacity, const double initial_energy,
+                           const char* params_filename);
+
+// Builds the map of the distance to the nearest dense block from the density
+// of the transport mesh
+void build_distance_map(Schedule* schedule, const int nx, const int ny,
+                        const int pad, const double* density);
+
+// Finds the cost bin of a history from its starting state
+static inline int cost_bin(const Schedule* schedule, const double density,
+                           const int distance, const double energy) {
+  int density_bin = COST_DENSITY_BINS - 1;
+  if (density > 0.0) {
+    density_bin = (int)(-log10(density / schedule->max_density) / 4.0);
+    density_bin = (density_bin < 0) ? 0 : density_bin;
+    density_bin = (density_bin >= COST_DENSITY_BINS) ? COST_DENSITY_BINS - 1
+                                                     : density_bin;
+  }
+  const int distance_bin =
+      (distance >= COST_DISTANCE_BINS) ? COST_DISTANCE_BINS - 1 : distance;
+  const double energy_bin =
+      log(energy / schedule->min_energy) * schedule->energy_scale;
+  int ebin = (energy_bin < 0.0) ? 0 : (int)energy_bin;
+  ebin = (ebin >= COST_ENERGY_BINS) ? COST_ENERGY_BINS - 1 : ebin;
+  return (density_bin * COST_DISTANCE_BINS + distance_bin) * COST_ENERGY_BINS +
+         ebin;
+}
+
+// Records the events taken by a history in a thread's statistics
+static inline void record_history_cost(const Schedule* schedule, double* sums,
+                                       const int bin, const uint64_t nevents) {
+  sums[2 * bin] += nevents;
+  sums[2 * bin + 1] += 1.0;
+
+  // Only histories with a prediction contribute to its accuracy
+  const double predicted = schedule->bin_cost[bin];
+  if (predicted >= 0.0) {
+    sums[COST_SUM_N] += 1.0;
+    sums[COST_SUM_X] += predicted;
+    sums[COST_SUM_Y] += nevents;
+    sums[COST_SUM_XX] += predicted * predicted;
+    sums[COST_SUM_YY] += (double)nevents * nevents;
+    sums[COST_SUM_XY] += predicted * nevents;
+  }
+}
+
+// Orders the slots by the predicted cost of their bins, largest first, with
+// the dead slots last
+void order_by_cost(Schedule* schedule, const int nslots);
+
+// Prints the accuracy of this timestep's predictions, and learns the cost of
+// each bin from its histories
+void update_cost_model(Schedule* schedule);
@@ -0,0 +1,739 @@
+#include "neutral_tally.h"
+#include "../comms.h"
+#include "../params.h"
+#include "../shared.h"
+#include "neutral_data.h"
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Allocates an empty sparse tally hash map
+size_t allocate_sparse_tally(Tally* tally, const int capacity);
+
+// Places an entry into the sparse tally, outside of any parallel region
+void insert_sparse_tally(Tally* tally, const int index, const double value);
+
+// Allocates the dense tally and the per-thread buffers that feed it
+size_t allocate_tally_buffers(Tally* tally, const char* params_filename);
+
+// Allocates the dense tally and the per-thread hot cell accumulators
+size_t allocate_hot_tally(Tally* tally, const char* params_filename);
+
+// Allocates the statistical batches if they are requested
+size_t allocate_tally_batches(Tally* tally, const char* params_filename);
+
+// Calculates the relative error of a total from its batch estimates
+double batch_relative_error(const double* batches, const int nbatches,
+                            const int stride);
+
+// Picks the most frequently hit cells from the sampled timestep
+void select_hot_cells(Tally* tally);
+
+// Adds the per-thread hot cell accumulators into the dense tally
+void merge_hot_cells(Tally* tally);
+
+// Orders tally entries by descending value
+int compare_hot_cells(const void* a, const void* b);
+
+// Fetches the file holding the reference tally for a problem
+void reference_tally_filename(const char* params_filename, const int rank,
+                              char* filename);
+
+// Initialises the energy deposition tally from the parameter file
+size_t initialise_tally(Tally* tally, const int mesh_nx, const int mesh_ny,
+                        const int nthreads, const char* params_filename) {
+
+  // The tally mesh defaults to the resolution of the transport mesh
+  tally->mesh_nx = mesh_nx;
+  tally->mesh_ny = mesh_ny;
+  tally->nx = get_optional_int_parameter("tally_nx", params_filename, mesh_nx);
+  tally->ny = get_optional_int_parameter("tally_ny", params_filename, mesh_ny);
+  if (tally->nx < 1 || tally->nx > mesh_nx || tally->ny < 1 ||
+      tally->ny > mesh_ny) {
+    TERMINATE("The tally mesh %dx%d must be no finer than the mesh %dx%d.\n",
+              tally->nx, tally->ny, mesh_nx, mesh_ny);
+  }
+
+  tally->nthreads = nthreads;
+  tally->energy_deposition = NULL;
+  tally->sparse_keys = NULL;
+  tally->sparse_values = NULL;
+  tally->sparse_overflow = NULL;
+  tally->staging_keys = NULL;
+  tally->staging_values = NULL;
+  tally->buffer = NULL;
+  tally->buffer_counts = NULL;
+  tally->buffer_stats = NULL;
+  tally->buffer_size = 0;
+  tally->hot_sampling = 0;
+  tally->nhot_cells = 0;
+  tally->hot_stride = 0;
+  tally->hot_slots = NULL;
+  tally->hot_cells = NULL;
+  tally->hot_values = NULL;
+  tally->fixed_deposition = NULL;
+  tally->fixed_scale = 0.0;
+  tally->sparse_capacity = 0;
+  tally->sparse_count = 0;
+  tally->auto_select = 0;
+
+  const size_t batch_allocation =
+      allocate_tally_batches(tally, params_filename);
+
+  char mode[MAX_STR_LEN];
+  if (!get_optional_parameter("tally_mode", params_filename, mode) ||
+      strcmp(mode, "dense") == 0) {
+    tally->mode = TALLY_DENSE;
+  } else if (strcmp(mode, "sparse") == 0) {
+    tally->mode = TALLY_SPARSE;
+  } else if (strcmp(mode, "buffered") == 0) {
+    tally->mode = TALLY_BUFFERED;
+  } else if (strcmp(mode, "hot") == 0) {
+    tally->mode = TALLY_HOT;
+  } else if (strcmp(mode, "reproducible") == 0) {
+    tally->mode = TALLY_REPRODUCIBLE;
+  } else if (strcmp(mode, "auto") == 0) {
+    tally->mode = TALLY_SPARSE;
+    tally->auto_select = 1;
+  } else {
+    TERMINATE("Unrecognised tally_mode %s.\n", mode);
+  }
+
+  const int ncells = tally->nx * tally->ny;
+  if (tally->mode == TALLY_DENSE) {
+    return batch_allocation +
+           allocate_data(&tally->energy_deposition, ncells);
+  }
+
+  if (tally->mode == TALLY_BUFFERED) {
+    return batch_allocation + allocate_tally_buffers(tally, params_filename);
+  }
+
+  if (tally->mode == TALLY_HOT) {
+    return batch_allocation + allocate_hot_tally(tally, params_filename);
+  }
+
+  if (tally->mode == TALLY_REPRODUCIBLE) {
+    tally->fixed_scale = get_optional_double_parameter(
+        "tally_fixed_point_scale", params_filename, 0.0);
+    tally->fixed_deposition = (int64_t*)calloc(ncells, sizeof(int64_t));
+    if (!tally->fixed_deposition) {
+      TERMINATE("Could not allocate the fixed point tally.\n");
+    }
+    return batch_allocation +
+           allocate_data(&tally->energy_deposition, ncells) +
+           sizeof(int64_t) * ncells;
+  }
+
+  // Start the hash map at a fraction of the dense tally, it will grow as
+  // more cells are touched, but never beyond twice the number of cells
+  int capacity = TALLY_SPARSE_MIN_CAPACITY;
+  const int default_capacity = get_optional_int_parameter(
+      "sparse_tally_capacity", params_filename, ncells / 16);
+  while (capacity < default_capacity && capacity < 2 * ncells) {
+    capacity *= 2;
+  }
+
+  size_t allocation =
+      batch_allocation + allocate_sparse_tally(tally, capacity);
+
+  tally->staging_keys = (int*)malloc(sizeof(int) * nthreads *
+                                     TALLY_STAGING_ENTRIES);
+  tally->staging_values = (double*)malloc(sizeof(double) * nthreads *
+                                          TALLY_STAGING_ENTRIES);
+  if (!tally->staging_keys || !tally->staging_values) {
+    TERMINATE("Could not allocate the tally staging buffers.\n");
+  }
+  for (int ii = 0; ii < nthreads * TALLY_STAGING_ENTRIES; ++ii) {
+    tally->staging_keys[ii] = TALLY_EMPTY_KEY;
+    tally->staging_values[ii] = 0.0;
+  }
+  allocation +=
+      (sizeof(int) + sizeof(double)) * nthreads * TALLY_STAGING_ENTRIES;
+
+  printf("Using a %s tally with %d hash map entries for %d cells.\n",
+         (tally->auto_select) ? "sparse (auto)" : "sparse", capacity, ncells);
+
+  return allocation;
+}
+
+// Allocates an empty sparse tally hash map
+size_t allocate_sparse_tally(Tally* tally, const int capacity) {
+  tally->sparse_capacity = capacity;
+  tally->sparse_count = 0;
+  tally->sparse_keys = (int*)malloc(sizeof(int) * capacity);
+  tally->sparse_values = (double*)malloc(sizeof(double) * capacity);
+  if (!tally->sparse_keys || !tally->sparse_values) {
+    TERMINATE("Could not allocate the sparse tally.\n");
+  }
+
+#pragma omp parallel for
+  for (int ii = 0; ii < capacity; ++ii) {
+    tally->sparse_keys[ii] = TALLY_EMPTY_KEY;
+    tally->sparse_values[ii] = 0.0;
+  }
+
+  return (sizeof(int) + sizeof(double)) * capacity;
+}
+
+// Allocates the dense tally and the per-thread buffers that feed it
+size_t allocate_tally_buffers(Tally* tally, const char* params_filename) {
+  tally->buffer_size = get_optional_int_parameter(
+      "tally_buffer_size", params_filename, TALLY_BUFFER_ENTRIES);
+  if (tally->buffer_size < 1) {
+    TERMINATE("The tally_buffer_size must be positive.\n");
+  }
+
+  const int nthreads = tally->nthreads;
+  tally->buffer = (TallyEntry*)malloc(sizeof(TallyEntry) * nthreads *
+                                      tally->buffer_size);
+  tally->buffer_counts =
+      (int*)calloc(nthreads * TALLY_BUFFER_STRIDE, sizeof(int));
+  tally->buffer_stats =
+      (uint64_t*)calloc(nthreads * TALLY_BUFFER_STRIDE, sizeof(uint64_t));
+  if (!tally->buffer || !tally->buffer_counts || !tally->buffer_stats) {
+    TERMINATE("Could not allocate the tally buffers.\n");
+  }
+
+  printf("Using a buffered tally with %d entries per thread.\n",
+         tally->buffer_size);
+
+  return allocate_data(&tally->energy_deposition, tally->nx * tally->ny) +
+         sizeof(TallyEntry) * nthreads * tally->buffer_size;
+}
+
+// Allocates the dense tally and the per-thread hot cell accumulators
+size_t allocate_hot_tally(Tally* tally, const char* params_filename) {
+  const int ncells = tally->nx * tally->ny;
+  tally->nhot_cells =
+      get_optional_int_parameter("hot_tally_cells", params_filename,
+                                 TALLY_HOT_CELLS);
+  if (tally->nhot_cells < 1) {
+    TERMINATE("The hot_tally_cells must be positive.\n");
+  }
+  if (tally->nhot_cells > ncells) {
+    tally->nhot_cells = ncells;
+  }
+
+  // Round each thread's accumulators up to a multiple of the cache line
+  tally->hot_stride = ((tally->nhot_cells + TALLY_BUFFER_STRIDE - 1) /
+                       TALLY_BUFFER_STRIDE) *
+                      TALLY_BUFFER_STRIDE;
+  tally->hot_sampling = 1;
+  tally->hot_slots = (int*)calloc(ncells, sizeof(int));
+  tally->hot_cells = (int*)malloc(sizeof(int) * tally->nhot_cells);
+  tally->hot_values = (double*)calloc(tally->nthreads * tally->hot_stride,
+                                      sizeof(double));
+  if (!tally->hot_slots || !tally->hot_cells || !tally->hot_values) {
+    TERMINATE("Could not allocate the hot tally cells.\n");
+  }
+
+  printf("Using a hot cell tally with %d private cells per thread.\n",
+         tally->nhot_cells);
+
+  return allocate_data(&tally->energy_deposition, ncells) +
+         sizeof(int) * (ncells + tally->nhot_cells) +
+         sizeof(double) * tally->nthreads * tally->hot_stride;
+}
+
+// Allocates the statistical batches if they are requested
+size_t allocate_tally_batches(Tally* tally, const char* params_filename) {
+  tally->nbatches = 0;
+  tally->batch_stride = 0;
+  tally->batch_totals = NULL;
+  tally->batch_cells = NULL;
+  tally->batch_x0 = 0;
+  tally->batch_y0 = 0;
+  tally->batch_nx = 0;
+  tally->batch_ny = 0;
+
+  int nkeys = 0;
+  char keys[MAX_KEYS * MAX_STR_LEN];
+  double values[MAX_KEYS];
+  if (!get_key_value_parameter("tally_batches", params_filename, keys, values,
+                               &nkeys)) {
+    return 0;
+  }
+
+  for (int kk = 0; kk < nkeys; ++kk) {
+    if (strcmp(&keys[kk * MAX_STR_LEN], "batches") == 0) {
+      tally->nbatches = (int)values[kk];
+    }
+  }
+  if (tally->nbatches < TALLY_MIN_BATCHES) {
+    TERMINATE("The tally_batches entry needs at least %d batches.\n",
+              TALLY_MIN_BATCHES);
+  }
+
+  // The last four keys optionally bound the region of cells whose error is
+  // estimated, as fractions of the domain
+  if (nkeys >= 5) {
+    const int x1 = (int)ceil(
+        (values[nkeys - 4] + values[nkeys - 2]) * tally->nx);
+    const int y1 = (int)ceil(
+        (values[nkeys - 3] + values[nkeys - 1]) * tally->ny);
+    tally->batch_x0 = (int)(values[nkeys - 4] * tally->nx);
+    tally->batch_y0 = (int)(values[nkeys - 3] * tally->ny);
+    tally->batch_x0 = (tally->batch_x0 < 0) ? 0 : tally->batch_x0;
+    tally->batch_y0 = (tally->batch_y0 < 0) ? 0 : tally->batch_y0;
+    tally->batch_nx = ((x1 < tally->nx) ? x1 : tally->nx) - tally->batch_x0;
+    tally->batch_ny = ((y1 < tally->ny) ? y1 : tally->ny) - tally->batch_y0;
+    if (tally->batch_nx < 1 || tally->batch_ny < 1) {
+      TERMINATE("The tally_batches region does not contain any cells.\n");
+    }
+  }
+
+  // Round each thread's batch totals up to a multiple of the cache line
+  tally->batch_stride = ((tally->nbatches + TALLY_BUFFER_STRIDE - 1) /
+                         TALLY_BUFFER_STRIDE) *
+                        TALLY_BUFFER_STRIDE;
+  const int nregion_cells = tally->batch_nx * tally->batch_ny;
+  tally->batch_totals = (double*)calloc(
+      tally->nthreads * tally->batch_stride, sizeof(double));
+  tally->batch_cells =
+      (double*)calloc(tally->nbatches * nregion_cells, sizeof(double));
+  if (!tally->batch_totals || !tally->batch_cells) {
+    TERMINATE("Could not allocate the tally batches.\n");
+  }
+
+  printf("Splitting the tally into %d batches with a %dx%d cell region.\n",
+         tally->nbatches, tally->batch_nx, tally->batch_ny);
+
+  return sizeof(double) * (tally->nthreads * tally->batch_stride +
+                           tally->nbatches * nregion_cells);
+}
+
+// Orders tally entries by descending value
+int compare_hot_cells(const void* a, const void* b) {
+  const double diff =
+      ((const TallyEntry*)b)->value - ((const TallyEntry*)a)->value;
+  return (diff > 0.0) - (diff < 0.0);
+}
+
+// Picks the most frequently hit cells from the sampled timestep
+void select_hot_cells(Tally* tally) {
+  const int ncells = tally->nx * tally->ny;
+
+  int nhit = 0;
+  uint64_t total_hits = 0;
+  TallyEntry* hits = (TallyEntry*)malloc(sizeof(TallyEntry) * ncells);
+  if (!hits) {
+    TERMINATE("Could not allocate the hot tally selection.\n");
+  }
+  for (int ii = 0; ii < ncells; ++ii) {
+    if (tally->hot_slots[ii]) {
+      hits[nhit].index = ii;
+      hits[nhit++].value = tally->hot_slots[ii];
+      total_hits += tally->hot_slots[ii];
+    }
+    tally->hot_slots[ii] = TALLY_COLD_CELL;
+  }
+
+  qsort(hits, nhit, sizeof(TallyEntry), compare_hot_cells);
+
+  uint64_t hot_hits = 0;
+  if (tally->nhot_cells > nhit) {
+    tally->nhot_cells = nhit;
+  }
+  for (int hh = 0; hh < tally->nhot_cells; ++hh) {
+    tally->hot_cells[hh] = hits[hh].index;
+    tally->hot_slots[hits[hh].index] = hh;
+    hot_hits += (uint64_t)hits[hh].value;
+  }
+  free(hits);
+
+  tally->hot_sampling = 0;
+  printf("Privatised %d hot tally cells covering %.1f%% of %" PRIu64
+         " hits.\n",
+         tally->nhot_cells,
+         (total_hits) ? 100.0 * hot_hits / total_hits : 0.0, total_hits);
+}
+
+// Adds the per-thread hot cell accumulators into the dense tally
+void merge_hot_cells(Tally* tally) {
+  for (int tt = 0; tt < tally->nthreads; ++tt) {
+    double* values = &tally->hot_values[tt * tally->hot_stride];
+    for (int hh = 0; hh < tally->nhot_cells; ++hh) {
+      tally->energy_deposition[tally->hot_cells[hh]] += values[hh];
+      values[hh] = 0.0;
+    }
+  }
+}
+
+// Places an entry into the sparse tally, outside of any parallel region
+void insert_sparse_tally(Tally* tally, const int index, const double value) {
+  const int mask = tally->sparse_capacity - 1;
+  int slot = tally_hash(index, tally->sparse_capacity);
+  while (tally->sparse_keys[slot] != TALLY_EMPTY_KEY &&
+         tally->sparse_keys[slot] != index) {
+    slot = (slot + 1) & mask;
+  }
+
+  if (tally->sparse_keys[slot] == TALLY_EMPTY_KEY) {
+    tally->sparse_keys[slot] = index;
+    tally->sparse_count++;
+  }
+  tally->sparse_values[slot] += value;
+}
+
+// Scales the fixed point tally to fit an upper bound on any cell's deposition
+void set_tally_fixed_point_bound(Tally* tally, const double bound) {
+  // The largest power of two that keeps the bound within the headroom, unless
+  // a scale was chosen in the parameter file
+  if (tally->fixed_scale <= 0.0) {
+    tally->fixed_scale =
+        ldexp(1.0, TALLY_FIXED_POINT_BITS - 1 - ilogb(bound));
+  }
+
+  printf("Using a reproducible tally with a resolution of %.4e.\n",
+         1.0 / tally->fixed_scale);
+}
+
+// Completes the tally at the end of a timestep, resizing the sparse tally or
+// switching to a dense tally if too many cells are touched
+void finalise_tally_step(Tally* tally) {
+  if (tally->mode == TALLY_REPRODUCIBLE) {
+    const int ncells = tally->nx * tally->ny;
+    for (int ii = 0; ii < ncells; ++ii) {
+      tally->energy_deposition[ii] =
+          tally->fixed_deposition[ii] / tally->fixed_scale;
+    }
+    return;
+  }
+
+  if (tally->mode == TALLY_HOT) {
+    if (tally->hot_sampling) {
+      select_hot_cells(tally);
+    } else {
+      merge_hot_cells(tally);
+    }
+    return;
+  }
+
+  if (tally->mode == TALLY_BUFFERED) {
+    uint64_t nflushes = 0;
+    uint64_t nentries = 0;
+    uint64_t nruns = 0;
+    for (int tt = 0; tt < tally->nthreads; ++tt) {
+      uint64_t* stats = &tally->buffer_stats[tt * TALLY_BUFFER_STRIDE];
+      nflushes += stats[0];
+      nentries += stats[1];
+      nruns += stats[2];
+      stats[0] = stats[1] = stats[2] = 0;
+    }
+    printf("Tally flushes %" PRIu64 "\n", nflushes);
+    printf("Tally run length %.2f\n",
+           (nruns) ? (double)nentries / nruns : 0.0);
+    return;
+  }
+
+  if (tally->mode != TALLY_SPARSE) {
+    return;
+  }
+
+  const int ncells = tally->nx * tally->ny;
+
+  // Dense tallies are cheaper once a large enough fraction of cells is touched
+  if (tally->auto_select &&
+      (tally->sparse_overflow ||
+       tally->sparse_count > TALLY_AUTO_DENSE_FRACTION * ncells)) {
+    gather_tally(tally);
+    free(tally->sparse_overflow);
+    free(tally->sparse_keys);
+    free(tally->sparse_values);
+    free(tally->staging_keys);
+    free(tally->staging_values);
+    tally->sparse_overflow = NULL;
+    tally->sparse_keys = NULL;
+    tally->sparse_values = NULL;
+    tally->staging_keys = NULL;
+    tally->staging_values = NULL;
+    tally->mode = TALLY_DENSE;
+    printf("Switched to a dense tally after touching %d of %d cells.\n",
+           tally->sparse_count, ncells);
+    return;
+  }
+
+  // Cells that overflowed the hash map also need an entry after rehashing
+  int noverflow = 0;
+  if (tally->sparse_overflow) {
+    for (int ii = 0; ii < ncells; ++ii) {
+      noverflow += (tally->sparse_overflow[ii] != 0.0);
+    }
+  }
+
+  // Rehash into a larger map if we are getting full, or overflowed
+  const int nentries = tally->sparse_count + noverflow;
+  if (tally->sparse_overflow ||
+      nentries > TALLY_SPARSE_MAX_LOAD * tally->sparse_capacity) {
+    int* keys = tally->sparse_keys;
+    double* values = tally->sparse_values;
+    const int old_capacity = tally->sparse_capacity;
+
+    int capacity = 2 * old_capacity;
+    while (capacity < 2 * ncells &&
+           nentries > TALLY_SPARSE_MAX_LOAD * capacity) {
+      capacity *= 2;
+    }
+    allocate_sparse_tally(tally, capacity);
+
+    for (int ii = 0; ii < old_capacity; ++ii) {
+      if (keys[ii] != TALLY_EMPTY_KEY) {
+        insert_sparse_tally(tally, keys[ii], values[ii]);
+      }
+    }
+    free(keys);
+    free(values);
+
+    if (tally->sparse_overflow) {
+      for (int ii = 0; ii < ncells; ++ii) {
+        if (tally->sparse_overflow[ii] != 0.0) {
+          insert_sparse_tally(tally, ii, tally->sparse_overflow[ii]);
+        }
+      }
+      free(tally->sparse_overflow);
+      tally->sparse_overflow = NULL;
+    }
+  }
+
+  printf("Tally cells %d of %d\n", tally->sparse_count, ncells);
+}
+
+// Gathers the tally into the dense energy deposition array for output
+double* gather_tally(Tally* tally) {
+  if (tally->mode != TALLY_SPARSE) {
+    return tally->energy_deposition;
+  }
+
+  const int ncells = tally->nx * tally->ny;
+  if (!tally->energy_deposition) {
+    allocate_data(&tally->energy_deposition, ncells);
+  }
+
+  if (tally->sparse_overflow) {
+    memcpy(tally->energy_deposition, tally->sparse_overflow,
+           sizeof(double) * ncells);
+  } else {
+    memset(tally->energy_deposition, 0, sizeof(double) * ncells);
+  }
+
+  for (int ii = 0; ii < tally->sparse_capacity; ++ii) {
+    if (tally->sparse_keys[ii] != TALLY_EMPTY_KEY) {
+      tally->energy_deposition[tally->sparse_keys[ii]] +=
+          tally->sparse_values[ii];
+    }
+  }
+
+  return tally->energy_deposition;
+}
+
+// Fetches the file holding the reference tally for a problem, which sits
+// alongside the parameter file, with a file for each rank beyond the master
+void reference_tally_filename(const char* params_filename, const int rank,
+                              char* filename) {
+  strncpy(filename, params_filename, MAX_STR_LEN - 1);
+  filename[MAX_STR_LEN - 1] = '\0';
+  char* extension = strrchr(filename, '.');
+  if (extension && !strchr(extension, '/')) {
+    *extension = '\0';
+  }
+
+  char suffix[MAX_STR_LEN];
+  if (rank == MASTER) {
+    sprintf(suffix, ".tally");
+  } else {
+    sprintf(suffix, ".tally.%d", rank);
+  }
+  strncat(filename, suffix, MAX_STR_LEN - strlen(filename) - 1);
+}
+
+// Calculates the relative error of a total from its batch estimates
+double batch_relative_error(const double* batches, const int nbatches,
+                            const int stride) {
+  double mean = 0.0;
+  for (int bb = 0; bb < nbatches; ++bb) {
+    mean += batches[bb * stride];
+  }
+  mean /= nbatches;
+  if (mean == 0.0) {
+    return 0.0;
+  }
+
+  double variance = 0.0;
+  for (int bb = 0; bb < nbatches; ++bb) {
+    const double diff = batches[bb * stride] - mean;
+    variance += diff * diff;
+  }
+  variance /= (nbatches - 1);
+  return sqrt(variance / nbatches) / mean;
+}
+
+// Prints the relative error of the total deposition, and of the cells in the
+// batch region, with the figure of merit for the time taken
+void print_batch_statistics(Tally* tally, const double wallclock) {
+  if (!tally->nbatches) {
+    return;
+  }
+
+  // Each batch's total over every thread and rank
+  double* totals = (double*)calloc(tally->nbatches, sizeof(double));
+  if (!totals) {
+    TERMINATE("Could not allocate the batch totals.\n");
+  }
+  for (int bb = 0; bb < tally->nbatches; ++bb) {
+    for (int tt = 0; tt < tally->nthreads; ++tt) {
+      totals[bb] += tally->batch_totals[tt * tally->batch_stride + bb];
+    }
+    totals[bb] = reduce_all_sum(totals[bb]);
+  }
+
+  const double total_error =
+      batch_relative_error(totals, tally->nbatches, 1);
+  printf("Batch relative error %.4e, FOM %.4e from %d batches\n",
+         total_error,
+         (total_error > 0.0) ? 1.0 / (total_error * total_error * wallclock)
+                             : 0.0,
+         tally->nbatches);
+  free(totals);
+
+  // The region's cells are only compared where some batch deposited
+  const int nregion_cells = tally->batch_nx * tally->batch_ny;
+  if (!nregion_cells) {
+    return;
+  }
+
+  int ntallied = 0;
+  double mean_variance = 0.0;
+  double max_error = 0.0;
+  for (int cc = 0; cc < nregion_cells; ++cc) {
+    const double error = batch_relative_error(&tally->batch_cells[cc],
+                                              tally->nbatches, nregion_cells);
+    if (error > 0.0) {
+      ntallied++;
+      mean_variance += error * error;
+      max_error = (error > max_error) ? error : max_error;
+    }
+  }
+
+  if (!ntallied) {
+    printf("Batch region received no deposition\n");
+    return;
+  }
+
+  mean_variance /= ntallied;
+  printf("Batch region mean relative error %.4e, max %.4e, FOM %.4e over %d "
+         "of %d cells\n",
+         sqrt(mean_variance), max_error,
+         1.0 / (mean_variance * wallclock), ntallied, nregion_cells);
+}
+
+// Compares every cell of a host tally against the problem's reference tally,
+// or records a new reference tally
+void validate_tally_cells(const int nx, const int ny,
+                          const char* params_filename, const int rank,
+                          const double* energy_deposition_tally) {
+
+  char filename[MAX_STR_LEN];
+  reference_tally_filename(params_filename, rank, filename);
+
+  char mode[MAX_STR_LEN];
+  if (get_optional_parameter("reference_tally", params_filename, mode) &&
+      strcmp(mode, "write") == 0) {
+    FILE* fp = fopen(filename, "wb");
+    if (!fp) {
+      TERMINATE("Could not open the reference tally file: %s\n", filename);
+    }
+    const int dims[2] = {nx, ny};
+    if (fwrite(dims, sizeof(int), 2, fp) != 2 ||
+        fwrite(energy_deposition_tally, sizeof(double), nx * ny, fp) !=
+            (size_t)(nx * ny) ||
+        fclose(fp) != 0) {
+      TERMINATE("Could not write the reference tally %s.\n", filename);
+    }
+    printf("Wrote the reference tally %s.\n", filename);
+    return;
+  }
+
+  // Per-cell validation is only performed where a reference has been recorded
+  FILE* fp = fopen(filename, "rb");
+  if (!fp) {
+    if (rank == MASTER) {
+      printf("No reference tally %s, could NOT validate cells.\n", filename);
+    }
+    return;
+  }
+
+  int dims[2];
+  if (fread(dims, sizeof(int), 2, fp) != 2 || dims[0] != nx || dims[1] != ny) {
+    TERMINATE("The reference tally %s does not match the %dx%d tally.\n",
+              filename, nx, ny);
+  }
+
+  double* reference = (double*)malloc(sizeof(double) * nx * ny);
+  if (!reference) {
+    TERMINATE("Could not allocate the reference tally.\n");
+  }
+  if (fread(reference, sizeof(double), nx * ny, fp) != (size_t)(nx * ny)) {
+    TERMINATE("Could not read the reference tally %s.\n", filename);
+  }
+  fclose(fp);
+
+  // Track the norms of the error and the cells with the largest errors
+  double l1_error = 0.0;
+  double l1_reference = 0.0;
+  double linf_error = 0.0;
+  double linf_reference = 0.0;
+  int worst_cells[TALLY_REFERENCE_WORST_CELLS];
+  double worst_errors[TALLY_REFERENCE_WORST_CELLS];
+  int nworst = 0;
+  for (int ii = 0; ii < nx * ny; ++ii) {
+    const double error = fabs(energy_deposition_tally[ii] - reference[ii]);
+    l1_error += error;
+    l1_reference += fabs(reference[ii]);
+    linf_error = fmax(linf_error, error);
+    linf_reference = fmax(linf_reference, fabs(reference[ii]));
+
+    if (error == 0.0 || (nworst == TALLY_REFERENCE_WORST_CELLS &&
+                         error <= worst_errors[nworst - 1])) {
+      continue;
+    }
+
+    // Insert the cell into the ordered list of worst cells
+    int ww = (nworst < TALLY_REFERENCE_WORST_CELLS) ? nworst++ : nworst - 1;
+    for (; ww > 0 && worst_errors[ww - 1] < error; --ww) {
+      worst_cells[ww] = worst_cells[ww - 1];
+      worst_errors[ww] = worst_errors[ww - 1];
+    }
+    worst_cells[ww] = ii;
+    worst_errors[ww] = error;
+  }
+
+  const double tolerance = get_optional_double_parameter(
+      "reference_tally_tolerance", params_filename, VALIDATE_TOLERANCE);
+  const double rel_l1_error =
+      (l1_reference > 0.0) ? l1_error / l1_reference : l1_error;
+  const double rel_linf_error =
+      (linf_reference > 0.0) ? linf_error / linf_reference : linf_error;
+  const int failed = (rel_l1_error > tolerance || rel_linf_error > tolerance);
+  const double nfailed = reduce_all_sum(failed);
+
+  if (rank == MASTER) {
+    printf("Cells compared against reference tally %s.\n", filename);
+    printf("L1 error %.6e (relative %.6e)\n", l1_error, rel_l1_error);
+    printf("Linf error %.6e (relative %.6e)\n", linf_error, rel_linf_error);
+    for (int ww = 0; ww < nworst; ++ww) {
+      const int ii = worst_cells[ww];
+      printf("Cell (%d, %d) expected %.12e, result was %.12e.\n", ii % nx,
+             ii / nx, reference[ii], energy_deposition_tally[ii]);
+    }
+    if (nfailed > 0.0) {
+      printf("FAILED cell validation.\n");
+    } else {
+      printf("PASSED cell validation.\n");
+    }
+  }
+
+  free(reference);
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Tally Constants */
+#define TALLY_STAGING_ENTRIES 256     // Direct-mapped staging slots per thread
+#define TALLY_EMPTY_KEY -1            // Marks an unused sparse tally entry
+#define TALLY_SPARSE_MIN_CAPACITY 1024 // Smallest sparse tally hash map
+#define TALLY_SPARSE_MAX_LOAD 0.5     // Load factor where the hash map grows
+#define TALLY_SPARSE_MAX_PROBES 32    // Probes before using the overflow
+#define TALLY_AUTO_DENSE_FRACTION 0.1 // Fraction of cells touched to go dense
+#define TALLY_BUFFER_ENTRIES 4096     // Default buffered updates per thread
+#define TALLY_BUFFER_STRIDE 16        // Pads per-thread counters to cache lines
+#define TALLY_HOT_CELLS 256           // Default privatised hot cells
+#define TALLY_COLD_CELL -1            // Marks a cell that is updated atomically
+#define TALLY_FIXED_POINT_BITS 62     // Bits of headroom in a fixed point cell
+#define TALLY_REFERENCE_WORST_CELLS 5 // Worst cells reported by validation
+#define TALLY_MIN_BATCHES 2           // Fewest batches that give a variance
+
+// The strategies for accumulating the energy deposition tally
+enum {
+  TALLY_DENSE,
+  TALLY_SPARSE,
+  TALLY_BUFFERED,
+  TALLY_HOT,
+  TALLY_REPRODUCIBLE
+};
+
+// A deposition held back in a thread's tally buffer
+typedef struct {
+  int index;
+  double value;
+} TallyEntry;
+
+// Represents the energy deposition tally, which is accumulated on its own mesh
+// that can be coarser than the transport mesh
+typedef struct {
+  double* energy_deposition; // Only gathered on output for a sparse tally
+  int nx;                    // tally cells in x
+  int ny;                    // tally cells in y
+
+  // The local transport mesh that is mapped onto the tally mesh
+  int mesh_nx;
+  int mesh_ny;
+
+  int mode;
+  int auto_select; // Switch from sparse to dense when enough cells are touched
+  int nthreads;
+
+  // Concurrent open addressing hash map keyed by the tally cell
+  int* sparse_keys;
+  double* sparse_values;
+  int sparse_capacity;
+  int sparse_count;
+
+  // Catches any deposition that could not be placed in a full hash map
+  double* sparse_overflow;
+
+  // Per-thread direct-mapped staging of recent sparse tally updates
+  int* staging_keys;
+  double* staging_values;
+
+  // Per-thread buffers of depositions that are sorted by cell and merged into
+  // the dense tally when full
+  TallyEntry* buffer;
+  int buffer_size;
+  int* buffer_counts;
+  uint64_t* buffer_stats; // flushes, entries and runs for each thread
+
+  // The hottest cells, found by sampling hits during the first timestep, are
+  // accumulated privately per thread and merged at the end of each timestep
+  int hot_sampling;
+  int nhot_cells;
+  int hot_stride;  // per-thread accumulators are padded to whole cache lines
+  int* hot_slots;  // per cell hit counts while sampling, then hot slot or cold
+  int* hot_cells;  // the tally cell for each hot slot
+  double* hot_values;
+
+  // Fixed point accumulation, where integer addition makes the tally
+  // independent of the order that particles deposit in
+  int64_t* fixed_deposition;
+  double fixed_scale;
+
+  // Statistical batches that split the histories by particle, giving the
+  // variance of the total deposition and of each cell in a chosen region
+  int nbatches;
+  int batch_stride;     // per-thread batch totals are padded to cache lines
+  double* batch_totals; // batch_stride totals for each thread
+  int batch_x0;         // the region's tally cells
+  int batch_y0;
+  int batch_nx;
+  int batch_ny;
+  double* batch_cells; // nbatches copies of the region's cells
+
+} Tally;
+
+// Initialises the energy deposition tally from the parameter file
+size_t initialise_tally(Tally* tally, const int mesh_nx, const int mesh_ny,
+                        const int nthreads, const char* params_filename);
+
+// Completes the tally at the end of a timestep, resizing the sparse tally or
+// switching to a dense tally if too many cells are touched
+void finalise_tally_step(Tally* tally);
+
+// Scales the fixed point tally to fit an upper bound on any cell's deposition
+void set_tally_fixed_point_bound(Tally* tally, const double bound);
+
+// Gathers the tally into the dense energy deposition array for output
+double* gather_tally(Tally* tally);
+
+// Prints the relative error of the total deposition, and of the cells in the
+// batch region, with the figure of merit for the time taken
+void print_batch_statistics(Tally* tally, const double wallclock);
+
+// Compares every cell of a host tally against the problem's reference tally,
+// or records a new reference tally
+void validate_tally_cells(const int nx, const int ny,
+                          const char* params_filename, const int rank,
+                          const double* energy_deposition_tally);
+
+// Hashes a tally cell into the sparse tally hash map
+static inline int tally_hash(const int index, const int capacity) {
+  return (int)(((uint32_t)index * UINT32_C(2654435761)) & (capacity - 1));
+}
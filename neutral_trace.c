@@ -0,0 +1,119 @@
+#include "neutral_trace.h"
+#include "../params.h"
+#include "../shared.h"
+#include "neutral_data.h"
+#include <inttypes.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Initialises the tracer from the parameter file
+size_t initialise_tracer(Tracer* tracer, const int nthreads, const int rank,
+                         const char* params_filename) {
+  tracer->nthreads = nthreads;
+  tracer->rank = rank;
+  tracer->events = NULL;
+  tracer->counts = NULL;
+  tracer->start_time = trace_time();
+
+  char filename[MAX_STR_LEN];
+  tracer->enabled =
+      get_optional_parameter("trace_file", params_filename, filename);
+  if (!tracer->enabled) {
+    return 0;
+  }
+
+  // Each rank writes its own trace
+  const int length =
+      (rank == MASTER)
+          ? snprintf(tracer->filename, sizeof(tracer->filename), "%s",
+                     filename)
+          : snprintf(tracer->filename, sizeof(tracer->filename), "%s.%d",
+                     filename, rank);
+  if (length >= (int)sizeof(tracer->filename)) {
+    TERMINATE("The trace_file %s is too long.\n", filename);
+  }
+
+  tracer->capacity =
+      get_optional_int_parameter("trace_events", params_filename, TRACE_EVENTS);
+  if (tracer->capacity < 1) {
+    TERMINATE("The trace_events must be positive.\n");
+  }
+
+  tracer->events =
+      (TraceEvent*)malloc(sizeof(TraceEvent) * nthreads * tracer->capacity);
+  tracer->counts = (uint64_t*)calloc(nthreads * TRACE_STRIDE, sizeof(uint64_t));
+  if (!tracer->events || !tracer->counts) {
+    TERMINATE("Could not allocate the trace buffers.\n");
+  }
+
+  return sizeof(TraceEvent) * nthreads * tracer->capacity;
+}
+
+// Fetches the current time for a trace event
+double trace_time(void) { return omp_get_wtime(); }
+
+// Records a span of work on the calling thread, overwriting the oldest span
+// once the thread's ring buffer is full
+void trace_event(Tracer* tracer, const char* name, const double begin,
+                 const double end) {
+  if (!tracer->enabled) {
+    return;
+  }
+
+  const int tid = omp_get_thread_num();
+  uint64_t* count = &tracer->counts[tid * TRACE_STRIDE];
+  TraceEvent* event =
+      &tracer->events[tid * tracer->capacity + (*count % tracer->capacity)];
+  event->name = name;
+  event->begin = begin;
+  event->end = end;
+  (*count)++;
+}
+
+// Writes the recorded spans as Chrome trace JSON
+void write_trace(Tracer* tracer) {
+  if (!tracer->enabled) {
+    return;
+  }
+
+  FILE* fp = fopen(tracer->filename, "w");
+  if (!fp) {
+    TERMINATE("Could not open the trace file: %s\n", tracer->filename);
+  }
+
+  fprintf(fp, "{\"traceEvents\":[\n");
+  int first = 1;
+  uint64_t ndropped = 0;
+  for (int tt = 0; tt < tracer->nthreads; ++tt) {
+    fprintf(fp,
+            "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+            "\"args\":{\"name\":\"thread %d\"}}",
+            (first) ? "" : ",\n", tracer->rank, tt, tt);
+    first = 0;
+
+    // Walk the ring buffer from the oldest span that was kept
+    const uint64_t count = tracer->counts[tt * TRACE_STRIDE];
+    const uint64_t nkept =
+        (count < (uint64_t)tracer->capacity) ? count : tracer->capacity;
+    ndropped += count - nkept;
+    for (uint64_t ee = count - nkept; ee < count; ++ee) {
+      TraceEvent* event =
+          &tracer->events[tt * tracer->capacity + (ee % tracer->capacity)];
+      fprintf(fp,
+              ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+              "\"pid\":%d,\"tid\":%d}",
+              event->name, (event->begin - tracer->start_time) * 1.0e6,
+              (event->end - event->begin) * 1.0e6, tracer->rank, tt);
+    }
+  }
+  fprintf(fp, "\n]}\n");
+  fclose(fp);
+
+  printf("Wrote the trace to %s", tracer->filename);
+  if (ndropped) {
+    printf(", dropping the %" PRIu64 " oldest events", ndropped);
+  }
+  printf(".\n");
+}
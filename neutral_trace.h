@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Trace Constants */
+#define TRACE_EVENTS 65536          // Default ring buffer entries per thread
+#define TRACE_STRIDE 16             // Pads per-thread counts to cache lines
+#define TRACE_CHUNK_HISTORIES 4096  // Histories recorded in each trace event
+#define TRACE_FILENAME_LEN 272      // Holds a trace_file with a rank suffix
+
+// A completed span of work on a thread, where the name is a string literal
+typedef struct {
+  const char* name;
+  double begin;
+  double end;
+
+} TraceEvent;
+
+// Records spans of work into per-thread ring buffers, to be written out as a
+// Chrome trace that can be viewed in chrome://tracing or Perfetto
+typedef struct {
+  TraceEvent* events; // capacity events for each thread
+  uint64_t* counts;   // TRACE_STRIDE entries for each thread
+  int capacity;
+  int nthreads;
+  int rank;
+  int enabled;
+  double start_time;
+  char filename[TRACE_FILENAME_LEN];
+
+} Tracer;
+
+// Initialises the tracer from the parameter file
+size_t initialise_tracer(Tracer* tracer, const int nthreads, const int rank,
+                         const char* params_filename);
+
+// Records a span of work on the calling thread, overwriting the oldest span
+// once the thread's ring buffer is full
+void trace_event(Tracer* tracer, const char* name, const double begin,
+                 const double end);
+
+// Fetches the current time for a trace event
+double trace_time(void);
+
+// Writes the recorded spans as Chrome trace JSON
+void write_trace(Tracer* tracer);
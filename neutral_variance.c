@@ -0,0 +1,181 @@
+#include "neutral_variance.h"
+#include "../params.h"
+#include "../shared.h"
+#include "neutral_data.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Reads the lower bounds of a weight window file
+size_t read_weight_windows(VarianceReduction* variance_reduction,
+                           const char* filename);
+
+// Initialises the variance reduction from the parameter file
+size_t initialise_variance_reduction(VarianceReduction* variance_reduction,
+                                     const int mesh_nx, const int mesh_ny,
+                                     const char* params_filename) {
+  variance_reduction->weight_cutoff = get_optional_double_parameter(
+      "roulette_weight_cutoff", params_filename, 0.0);
+  variance_reduction->survival_weight =
+      get_optional_double_parameter("roulette_survival_weight",
+                                    params_filename,
+                                    2.0 * variance_reduction->weight_cutoff);
+
+  if (variance_reduction->weight_cutoff < 0.0) {
+    TERMINATE("The roulette_weight_cutoff must not be negative.\n");
+  }
+  if (variance_reduction->weight_cutoff > 0.0) {
+    if (variance_reduction->survival_weight <=
+        variance_reduction->weight_cutoff) {
+      TERMINATE("The roulette_survival_weight must exceed the cutoff.\n");
+    }
+    printf("Rouletting particles below weight %.3e, survivors take weight "
+           "%.3e.\n",
+           variance_reduction->weight_cutoff,
+           variance_reduction->survival_weight);
+  }
+
+  variance_reduction->window_lower = NULL;
+  variance_reduction->window_nx = 0;
+  variance_reduction->window_ny = 0;
+  variance_reduction->window_mesh_nx = mesh_nx;
+  variance_reduction->window_mesh_ny = mesh_ny;
+  variance_reduction->window_upper_ratio = get_optional_double_parameter(
+      "weight_window_upper_ratio", params_filename,
+      WEIGHT_WINDOW_UPPER_RATIO);
+  variance_reduction->window_survival_ratio = get_optional_double_parameter(
+      "weight_window_survival_ratio", params_filename,
+      WEIGHT_WINDOW_SURVIVAL_RATIO);
+  variance_reduction->window_max_split = get_optional_int_parameter(
+      "weight_window_max_split", params_filename, WEIGHT_WINDOW_MAX_SPLIT);
+
+  if (variance_reduction->window_survival_ratio <= 1.0 ||
+      variance_reduction->window_upper_ratio <=
+          variance_reduction->window_survival_ratio) {
+    TERMINATE("The weight window ratios must satisfy 1 < survival < upper.\n");
+  }
+  if (variance_reduction->window_max_split < 1) {
+    TERMINATE("The weight_window_max_split must be positive.\n");
+  }
+
+  variance_reduction->window_output = NULL;
+  char filename[MAX_STR_LEN];
+  if (get_optional_parameter("weight_window_generate", params_filename,
+                             filename)) {
+    variance_reduction->window_output = (char*)malloc(strlen(filename) + 1);
+    if (!variance_reduction->window_output) {
+      TERMINATE("Could not allocate the weight window filename.\n");
+    }
+    strcpy(variance_reduction->window_output, filename);
+  }
+
+  if (!get_optional_parameter("weight_windows", params_filename, filename)) {
+    return 0;
+  }
+
+  return read_weight_windows(variance_reduction, filename);
+}
+
+// Reads the lower bounds of a weight window file
+size_t read_weight_windows(VarianceReduction* variance_reduction,
+                           const char* filename) {
+  FILE* fp = fopen(filename, "rb");
+  if (!fp) {
+    TERMINATE("Could not open the weight window file %s.\n", filename);
+  }
+
+  int dims[2];
+  if (fread(dims, sizeof(int), 2, fp) != 2 || dims[0] < 1 ||
+      dims[0] > variance_reduction->window_mesh_nx || dims[1] < 1 ||
+      dims[1] > variance_reduction->window_mesh_ny) {
+    TERMINATE("The weight windows in %s must be no finer than the mesh.\n",
+              filename);
+  }
+
+  const int ncells = dims[0] * dims[1];
+  variance_reduction->window_nx = dims[0];
+  variance_reduction->window_ny = dims[1];
+  variance_reduction->window_lower = (double*)malloc(sizeof(double) * ncells);
+  if (!variance_reduction->window_lower) {
+    TERMINATE("Could not allocate the weight windows.\n");
+  }
+  if (fread(variance_reduction->window_lower, sizeof(double), ncells, fp) !=
+      (size_t)ncells) {
+    TERMINATE("Could not read the weight windows from %s.\n", filename);
+  }
+  fclose(fp);
+
+  printf("Using %dx%d weight windows from %s.\n", dims[0], dims[1], filename);
+
+  return sizeof(double) * ncells;
+}
+
+// Generates weight windows from a host tally of the deposition, with bounds
+// proportional to the flux estimated by the deposition per unit density, so
+// that the particle population stays even across the mesh
+void generate_weight_windows(const VarianceReduction* variance_reduction,
+                             const int nx, const int ny,
+                             const double* energy_deposition_tally,
+                             const int mesh_nx, const int mesh_ny,
+                             const int pad, const double* density) {
+  if (!variance_reduction->window_output) {
+    return;
+  }
+
+  // Average the density over the transport cells within each tally cell
+  double* flux = (double*)calloc(nx * ny, sizeof(double));
+  double* lower = (double*)malloc(sizeof(double) * nx * ny);
+  if (!flux || !lower) {
+    TERMINATE("Could not allocate the generated weight windows.\n");
+  }
+  const int inner_nx = mesh_nx - 2 * pad;
+  const int inner_ny = mesh_ny - 2 * pad;
+  for (int ii = 0; ii < inner_ny; ++ii) {
+    for (int jj = 0; jj < inner_nx; ++jj) {
+      flux[((ii * ny) / inner_ny) * nx + (jj * nx) / inner_nx] +=
+          density[(ii + pad) * mesh_nx + (jj + pad)];
+    }
+  }
+
+  // The bounds peak where the flux peaks, which is expected to be at the
+  // source, so that source particles start inside their windows
+  double max_flux = 0.0;
+  double min_flux = 0.0;
+  for (int ii = 0; ii < nx * ny; ++ii) {
+    flux[ii] = (flux[ii] > 0.0) ? energy_deposition_tally[ii] / flux[ii] : 0.0;
+    if (flux[ii] > max_flux) {
+      max_flux = flux[ii];
+    }
+    if (flux[ii] > 0.0 && (min_flux == 0.0 || flux[ii] < min_flux)) {
+      min_flux = flux[ii];
+    }
+  }
+  if (max_flux == 0.0) {
+    TERMINATE("Could not generate weight windows without any deposition.\n");
+  }
+
+  // Cells that were never reached take the smallest bound, so that any
+  // particle arriving there is split rather than left unchecked
+  for (int ii = 0; ii < nx * ny; ++ii) {
+    lower[ii] = WEIGHT_WINDOW_SOURCE_BOUND *
+                ((flux[ii] > 0.0) ? flux[ii] : min_flux) / max_flux;
+  }
+
+  FILE* fp = fopen(variance_reduction->window_output, "wb");
+  if (!fp) {
+    TERMINATE("Could not open the weight window file %s.\n",
+              variance_reduction->window_output);
+  }
+  const int dims[2] = {nx, ny};
+  if (fwrite(dims, sizeof(int), 2, fp) != 2 ||
+      fwrite(lower, sizeof(double), nx * ny, fp) != (size_t)(nx * ny)) {
+    TERMINATE("Could not write the weight windows to %s.\n",
+              variance_reduction->window_output);
+  }
+  fclose(fp);
+  free(flux);
+  free(lower);
+
+  printf("Generated %dx%d weight windows in %s.\n", nx, ny,
+         variance_reduction->window_output);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+
+/* Variance Reduction Constants */
+#define WEIGHT_WINDOW_UPPER_RATIO 5.0    // Default upper over lower bound
+#define WEIGHT_WINDOW_SURVIVAL_RATIO 3.0 // Default survival over lower bound
+#define WEIGHT_WINDOW_MAX_SPLIT 10       // Default most copies from a split
+#define WEIGHT_WINDOW_SOURCE_BOUND 0.5   // Generated bound where flux peaks
+
+// The variance reduction applied to the weights of particles in transport
+typedef struct {
+  double weight_cutoff;   // particles below this weight face roulette, or 0
+  double survival_weight; // the weight given to particles surviving roulette
+
+  // Weight windows on a mesh that uniformly coarsens the transport mesh, where
+  // particles below a cell's lower bound face roulette and those above its
+  // upper bound are split, and a lower bound of 0 leaves the cell unchecked
+  double* window_lower;
+  int window_nx;
+  int window_ny;
+  int window_mesh_nx;
+  int window_mesh_ny;
+  double window_upper_ratio;
+  double window_survival_ratio;
+  int window_max_split;
+
+  // Windows generated from the run's deposition are written here, if set
+  char* window_output;
+
+} VarianceReduction;
+
+// Initialises the variance reduction from the parameter file
+size_t initialise_variance_reduction(VarianceReduction* variance_reduction,
+                                     const int mesh_nx, const int mesh_ny,
+                                     const char* params_filename);
+
+// Generates weight windows from a host tally of the deposition, with bounds
+// proportional to the flux estimated by the deposition per unit density, so
+// that the particle population stays even across the mesh
+void generate_weight_windows(const VarianceReduction* variance_reduction,
+                             const int nx, const int ny,
+                             const double* energy_deposition_tally,
+                             const int mesh_nx, const int mesh_ny,
+                             const int pad, const double* density);
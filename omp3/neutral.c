@@ -6,8 +6,10 @@
 #include "../neutral_interface.h"
 #include <assert.h>
 #include <float.h>
+#include <inttypes.h>
 #include <math.h>
 #include <omp.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -15,28 +17,689 @@
 #include "mpi.h"
 #endif
 
-// Performs a solve of dependent variables for particle transport
-void solve_transport_2d(
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SPIN_PAUSE() _mm_pause()
+#else
+#define SPIN_PAUSE()
+#endif
+
+// The calling thread's event counters, which are NULL unless enabled
+static uint64_t* thread_counters = NULL;
+#pragma omp threadprivate(thread_counters)
+
+// The statistical batch of the history that the calling thread is tracking
+static int thread_batch = 0;
+#pragma omp threadprivate(thread_batch)
+
+// The block of the bank that the calling thread has reserved for staging the
+// secondaries it produces, where slots up to the end are still free
+static int thread_secondary_slot = 0;
+static int thread_secondary_end = 0;
+#pragma omp threadprivate(thread_secondary_slot, thread_secondary_end)
+
+// Adds to one of the calling thread's event counters
+#define COUNT_EVENTS(event, n)                                                 \
+  do {                                                                         \
+    if (thread_counters) {                                                     \
+      thread_counters[event] += (n);                                           \
+    }                                                                          \
+  } while (0)
+
+// Performs a solve of dependent variables for particle transport, returning
+// the number of particles left alive
+int solve_transport_2d(
     const int nx, const int ny, const int global_nx, const int global_ny,
     const uint64_t master_key, const int pad, const int x_off, const int y_off,
     const double dt, const int ntotal_particles, int* nparticles,
     const int* neighbours, Particle* particles, const double* density,
     const double* edgex, const double* edgey, const double* edgedx,
     const double* edgedy, CrossSection* cs_scatter_table,
-    CrossSection* cs_absorb_table, double* energy_deposition_tally,
-    uint64_t* reduce_array0, uint64_t* reduce_array1, uint64_t* reduce_array2,
-    uint64_t* facet_events, uint64_t* collision_events) {
+    CrossSection* cs_absorb_table, const Regions* regions, Tally* tally,
+    const VarianceReduction* variance_reduction, Schedule* schedule,
+    EventCounters* counters, Tracer* tracer, uint64_t* reduce_array0,
+    uint64_t* reduce_array1, uint64_t* reduce_array2, uint64_t* facet_events,
+    uint64_t* collision_events) {
 
   if (!(*nparticles)) {
     printf("Out of particles\n");
-    return;
+    return 0;
+  }
+
+  // Secondaries, such as the copies made by the weight windows, are banked
+  // after the existing particles and tracked in later sweeps from where they
+  // were produced, until a sweep produces no more
+  int nbanked = *nparticles;
+  uint64_t nlive = 0;
+
+  // The particles that start the step are ordered by their predicted cost
+  if (schedule->lpt) {
+    if (schedule->max_density == 0.0) {
+      build_distance_map(schedule, nx, ny, pad, density);
+    }
+    bin_histories(nx, ny, pad, x_off, y_off, *nparticles, particles, density,
+                  regions, schedule);
+    order_by_cost(schedule, *nparticles);
   }
 
   handle_particles(global_nx, global_ny, nx, ny, master_key, pad, x_off, y_off,
                    1, dt, neighbours, density, edgex, edgey, edgedx, edgedy,
-                   facet_events, collision_events, ntotal_particles,
-                   *nparticles, particles, cs_scatter_table, cs_absorb_table,
-                   energy_deposition_tally);
+                   facet_events, collision_events, ntotal_particles, 0,
+                   *nparticles, particles, &nbanked, &nlive, cs_scatter_table,
+                   cs_absorb_table, regions, tally, variance_reduction,
+                   schedule, counters, tracer);
+
+  const int capacity = PARTICLE_BANK_FACTOR * ntotal_particles;
+  int nswept = *nparticles;
+  while (nswept < min(nbanked, capacity)) {
+    const int nsplit = min(nbanked, capacity) - nswept;
+    handle_particles(global_nx, global_ny, nx, ny, master_key, pad, x_off,
+                     y_off, 0, dt, neighbours, density, edgex, edgey, edgedx,
+                     edgedy, facet_events, collision_events, ntotal_particles,
+                     nswept, nsplit, particles, &nbanked, &nlive,
+                     cs_scatter_table, cs_absorb_table, regions, tally,
+                     variance_reduction, schedule, counters, tracer);
+    nswept += nsplit;
+  }
+  if (nswept > *nparticles) {
+    printf("Banked %d secondary particles\n", nswept - *nparticles);
+    *nparticles = nswept;
+  }
+
+  update_cost_model(schedule);
+
+  // Once most of the bank is dead, the live particles are moved to the front
+  // so that later steps do not scan the dead slots
+  if (nlive <= (uint64_t)*nparticles / 2) {
+    compact_particles(nparticles, particles);
+  }
+
+  print_event_counters(counters);
+  print_history_stats(counters);
+
+  return (int)nlive;
+}
+
+// Finds the cost bin of each particle from its starting state
+void bin_histories(const int nx, const int ny, const int pad, const int x_off,
+                   const int y_off, const int nparticles,
+                   const Particle* particles, const double* density,
+                   const Regions* regions, Schedule* schedule) {
+
+#pragma omp parallel for
+  for (int pp = 0; pp < nparticles; ++pp) {
+    const Particle* particle = &particles[pp];
+    if (particle->dead) {
+      schedule->bins[pp] = -1;
+      continue;
+    }
+
+    const int cellx = particle->cellx - x_off;
+    const int celly = particle->celly - y_off;
+    const double local_density =
+        (regions)
+            ? region_density(regions, particle->x, particle->y)
+            : density[(celly + pad) * (nx + 2 * pad) + (cellx + pad)];
+    const int block = ((celly * COST_MAP_BLOCKS) / ny) * COST_MAP_BLOCKS +
+                      (cellx * COST_MAP_BLOCKS) / nx;
+    schedule->bins[pp] =
+        cost_bin(schedule, local_density, schedule->distance_map[block],
+                 particle->energy);
+  }
+}
+
+// Moves the live particles to the front of the bank, keeping their order
+void compact_particles(int* nparticles, Particle* particles) {
+
+  int nlive = 0;
+  for (int pp = 0; pp < *nparticles; ++pp) {
+    if (!particles[pp].dead) {
+      if (pp != nlive) {
+        particles[nlive] = particles[pp];
+      }
+      nlive++;
+    }
+  }
+
+  printf("Compacted the particle bank from %d to %d particles\n", *nparticles,
+         nlive);
+  *nparticles = nlive;
+}
+
+// Starts tracking a history, looking up the state that is not kept in the
+// particle, or taking it from the history's suspension
+static inline void start_history(
+    const int nx, const int pad, const int x_off, const int y_off,
+    const int initial, const double dt, const uint64_t master_key,
+    const double* density, const Regions* regions,
+    const CrossSection* cs_scatter_table, const CrossSection* cs_absorb_table,
+    Particle* particles, const int pid, const SuspendedHistory* resumed,
+    const int event_budget, History* state) {
+
+  Particle* particle = &particles[pid];
+  state->particle = particle;
+  state->pkey = particle->key;
+  state->pid = pid;
+  state->counter = (resumed) ? resumed->counter : 0;
+  state->first_counter = state->counter;
+  state->nevents = (resumed) ? resumed->nevents : 0;
+  state->suspend_events = (event_budget) ? state->nevents + event_budget : 0;
+
+  // Determine the current cell, and the density of the region the
+  // particle is in when we are tracking against region boundaries
+  state->cellx = particle->cellx - x_off + pad;
+  state->celly = particle->celly - y_off + pad;
+  state->local_density =
+      (regions) ? region_density(regions, particle->x, particle->y)
+                : density[state->celly * (nx + 2 * pad) + state->cellx];
+
+  // Particles carried over from census keep their cross sections and
+  // speed, so only new particles need to look them up
+  const int untracked = (particle->scatter_cs_index == -1);
+  if (untracked) {
+    particle->microscopic_cs_scatter = microscopic_cs_for_energy(
+        cs_scatter_table, particle->energy, &particle->scatter_cs_index);
+    particle->microscopic_cs_absorb = microscopic_cs_for_energy(
+        cs_absorb_table, particle->energy, &particle->absorb_cs_index);
+    particle->speed = sqrt((2.0 * particle->energy * eV_TO_J) / PARTICLE_MASS);
+  }
+  state->scatter_cs_index = particle->scatter_cs_index;
+  state->absorb_cs_index = particle->absorb_cs_index;
+  state->microscopic_cs_scatter = particle->microscopic_cs_scatter;
+  state->microscopic_cs_absorb = particle->microscopic_cs_absorb;
+  state->speed = particle->speed;
+  state->number_density = (state->local_density * AVOGADROS / MOLAR_MASS);
+  state->macroscopic_cs_scatter =
+      state->number_density * state->microscopic_cs_scatter * BARNS;
+  state->macroscopic_cs_absorb =
+      state->number_density * state->microscopic_cs_absorb * BARNS;
+  state->energy_deposition = 0.0;
+
+  // Set time to census and MFPs until collision, unless travelled
+  // particle. The MFPs are sampled against the local cross section, so
+  // are sampled again rather than carried over from census
+  if (initial && !resumed) {
+    double rn[NRANDOM_NUMBERS];
+    particle->dt_to_census = dt;
+    generate_random_numbers(state->pkey, master_key, state->counter++, &rn[0],
+                            &rn[1]);
+    particle->mfp_to_collision =
+        -log(rn[0]) / state->macroscopic_cs_scatter;
+  }
+}
+
+// Handles the next event of a history from the distance to its next facet,
+// returning PARTICLE_CONTINUE until the history ends or is suspended
+static inline int handle_event(
+    const int global_nx, const int global_ny, const int nx, const int ny,
+    const uint64_t master_key, const int pad, const int x_off, const int y_off,
+    const int* neighbours, const double* density, const double* edgex,
+    const double* edgey, const int ntotal_particles,
+    const double inv_ntotal_particles, Particle* particles, int* nbanked,
+    const CrossSection* cs_scatter_table, const CrossSection* cs_absorb_table,
+    const Regions* regions, Tally* tally,
+    const VarianceReduction* variance_reduction, History* state,
+    uint64_t* nfacets, uint64_t* ncollisions, uint64_t* nroulette_kills,
+    uint64_t* nsplits,
+    const double cell_mfp, const double distance_to_facet, const int x_facet,
+    const int reflect) {
+
+  Particle* particle = state->particle;
+  const uint64_t pkey = state->pkey;
+
+  // Histories are split into batches by particle for the tally variance
+  if (tally->nbatches) {
+    thread_batch = pkey % tally->nbatches;
+  }
+
+  double rn[NRANDOM_NUMBERS];
+  int result = PARTICLE_CONTINUE;
+
+  const double distance_to_collision = particle->mfp_to_collision * cell_mfp;
+  const double distance_to_census = state->speed * particle->dt_to_census;
+
+  // Check if our next event is a collision
+  if (distance_to_collision < distance_to_facet &&
+      distance_to_collision < distance_to_census) {
+
+    // Track the total number of collisions
+    (*ncollisions)++;
+    state->nevents++;
+    COUNT_EVENTS(COUNT_COLLISIONS, 1);
+
+    // Handles a collision event
+    result = collision_event(
+        global_nx, global_ny, nx, pad, x_off, y_off, pkey, master_key,
+        inv_ntotal_particles, distance_to_collision, state->local_density,
+        cs_scatter_table, cs_absorb_table, regions, edgex, edgey, particle,
+        &state->counter, &state->energy_deposition, &state->number_density,
+        &state->microscopic_cs_scatter, &state->microscopic_cs_absorb,
+        &state->macroscopic_cs_scatter, &state->macroscopic_cs_absorb, tally,
+        variance_reduction, &state->scatter_cs_index, &state->absorb_cs_index,
+        rn, &state->speed);
+
+    if (result != PARTICLE_CONTINUE) {
+      COUNT_EVENTS(COUNT_DEATHS, (result == PARTICLE_DEAD));
+
+      // Particles above the energy cut off can only die in roulette
+      *nroulette_kills += (result == PARTICLE_DEAD &&
+                           particle->energy >= MIN_ENERGY_OF_INTEREST);
+      return result;
+    }
+  }
+  // Check if we have reached facet
+  else if (distance_to_facet < distance_to_census) {
+
+    // Track the number of fact encounters
+    (*nfacets)++;
+    state->nevents++;
+    COUNT_EVENTS(COUNT_FACETS, 1);
+
+    if (regions) {
+      result = region_event(
+          global_nx, global_ny, nx, pad, x_off, y_off, inv_ntotal_particles,
+          distance_to_facet, state->speed, cell_mfp, reflect, regions, edgex,
+          edgey, particle, &state->energy_deposition, &state->number_density,
+          &state->microscopic_cs_scatter, &state->microscopic_cs_absorb,
+          &state->macroscopic_cs_scatter, &state->macroscopic_cs_absorb, tally,
+          &state->local_density);
+    } else {
+      result = facet_event(
+          global_nx, global_ny, nx, ny, x_off, y_off, inv_ntotal_particles,
+          distance_to_facet, state->speed, cell_mfp, x_facet, density,
+          neighbours, particle, &state->energy_deposition,
+          &state->number_density, &state->microscopic_cs_scatter,
+          &state->microscopic_cs_absorb, &state->macroscopic_cs_scatter,
+          &state->macroscopic_cs_absorb, tally, &state->cellx, &state->celly,
+          &state->local_density);
+    }
+
+    if (result != PARTICLE_CONTINUE) {
+      return result;
+    }
+
+  } else {
+
+    census_event(global_nx, global_ny, nx, pad, x_off, y_off,
+                 inv_ntotal_particles, distance_to_census, cell_mfp, regions,
+                 edgex, edgey, particle, &state->energy_deposition,
+                 &state->number_density, &state->microscopic_cs_scatter,
+                 &state->microscopic_cs_absorb, tally);
+    COUNT_EVENTS(COUNT_CENSUS, 1);
+
+    return PARTICLE_CENSUS;
+  }
+
+  // Check the particle against the window of the cell it is now in
+  if (variance_reduction->window_lower) {
+    result = weight_window_event(
+        x_off, y_off, pkey, master_key, ntotal_particles, inv_ntotal_particles,
+        variance_reduction, particle, &state->counter,
+        &state->energy_deposition, tally, particles, nbanked, nsplits);
+
+    if (result != PARTICLE_CONTINUE) {
+      COUNT_EVENTS(COUNT_DEATHS, 1);
+      (*nroulette_kills)++;
+      return result;
+    }
+  }
+
+  // Stop a history that has used its event budget, so that an idle thread
+  // can resume it
+  if (state->suspend_events && state->nevents >= state->suspend_events) {
+    return PARTICLE_SUSPENDED;
+  }
+
+  return PARTICLE_CONTINUE;
+}
+
+// Tracks a history to its next event, returning PARTICLE_CONTINUE until the
+// history ends or is suspended
+static inline int track_event(
+    const int global_nx, const int global_ny, const int nx, const int ny,
+    const uint64_t master_key, const int pad, const int x_off, const int y_off,
+    const int* neighbours, const double* density, const double* edgex,
+    const double* edgey, const int ntotal_particles,
+    const double inv_ntotal_particles, Particle* particles, int* nbanked,
+    const CrossSection* cs_scatter_table, const CrossSection* cs_absorb_table,
+    const Regions* regions, Tally* tally,
+    const VarianceReduction* variance_reduction, History* state,
+    uint64_t* nfacets, uint64_t* ncollisions, uint64_t* nroulette_kills,
+    uint64_t* nsplits) {
+
+  Particle* particle = state->particle;
+
+  // Loop until we have reached census
+  if (particle->dt_to_census <= 0.0) {
+    return PARTICLE_CENSUS;
+  }
+
+  int x_facet = 0;
+  int reflect = NO_REFLECTION;
+  const double cell_mfp =
+      1.0 / (state->macroscopic_cs_scatter + state->macroscopic_cs_absorb);
+
+  // Work out the distance until the particle hits a facet, or a region
+  // boundary if the mesh is only being used for tallies
+  double distance_to_facet = 0.0;
+  if (regions) {
+    calc_distance_to_region_boundary(regions, particle->x, particle->y,
+                                     particle->omega_x, particle->omega_y,
+                                     &distance_to_facet, &reflect);
+  } else {
+    calc_distance_to_facet(global_nx, particle->x, particle->y, pad, x_off,
+                           y_off, particle->omega_x, particle->omega_y,
+                           state->speed, particle->cellx, particle->celly,
+                           &distance_to_facet, &x_facet, edgex, edgey);
+  }
+
+  return handle_event(
+      global_nx, global_ny, nx, ny, master_key, pad, x_off, y_off, neighbours,
+      density, edgex, edgey, ntotal_particles, inv_ntotal_particles, particles,
+      nbanked, cs_scatter_table, cs_absorb_table, regions, tally,
+      variance_reduction, state, nfacets, ncollisions, nroulette_kills, nsplits,
+      cell_mfp, distance_to_facet, x_facet, reflect);
+}
+
+// Finds the cell MFP and the distance to the next facet of every history in
+// flight at once, gathering their state into lanes so that the mesh tracking
+// is vectorised across the histories
+static inline void find_next_facets(const int nlanes, const History* in_flight,
+                                    const int pad, const int x_off,
+                                    const int y_off, const double* edgex,
+                                    const double* edgey,
+                                    const Regions* regions, Lanes* lanes) {
+
+  for (int ll = 0; ll < nlanes; ++ll) {
+    const History* state = &in_flight[ll];
+    const Particle* particle = state->particle;
+    lanes->x[ll] = particle->x;
+    lanes->y[ll] = particle->y;
+    lanes->omega_x[ll] = particle->omega_x;
+    lanes->omega_y[ll] = particle->omega_y;
+    lanes->speed[ll] = state->speed;
+    lanes->macroscopic_cs[ll] =
+        state->macroscopic_cs_scatter + state->macroscopic_cs_absorb;
+    lanes->cellx[ll] = particle->cellx - x_off + pad;
+    lanes->celly[ll] = particle->celly - y_off + pad;
+    lanes->x_facet[ll] = 0;
+    lanes->reflect[ll] = NO_REFLECTION;
+
+    // Region boundaries are found for each history in turn
+    if (regions) {
+      calc_distance_to_region_boundary(
+          regions, particle->x, particle->y, particle->omega_x,
+          particle->omega_y, &lanes->distance_to_facet[ll],
+          &lanes->reflect[ll]);
+    }
+  }
+
+#pragma omp simd
+  for (int ll = 0; ll < nlanes; ++ll) {
+    lanes->cell_mfp[ll] = 1.0 / lanes->macroscopic_cs[ll];
+  }
+
+  if (regions) {
+    return;
+  }
+
+  // The same arithmetic as calc_distance_to_facet, with the edges of each
+  // lane's cell gathered and the branches on the direction masked
+#pragma omp simd
+  for (int ll = 0; ll < nlanes; ++ll) {
+    const double x = lanes->x[ll];
+    const double y = lanes->y[ll];
+    const double speed = lanes->speed[ll];
+    const double u_x_inv = 1.0 / (lanes->omega_x[ll] * speed);
+    const double u_y_inv = 1.0 / (lanes->omega_y[ll] * speed);
+    const double edge_x =
+        (lanes->omega_x[ll] >= 0.0)
+            ? edgex[lanes->cellx[ll] + 1]
+            : edgex[lanes->cellx[ll]] - OPEN_BOUND_CORRECTION;
+    const double edge_y =
+        (lanes->omega_y[ll] >= 0.0)
+            ? edgey[lanes->celly[ll] + 1]
+            : edgey[lanes->celly[ll]] - OPEN_BOUND_CORRECTION;
+    const double dt_x = (edge_x - x) * u_x_inv;
+    const double dt_y = (edge_y - y) * u_y_inv;
+    const int x_facet = (dt_x < dt_y) ? 1 : 0;
+    lanes->x_facet[ll] = x_facet;
+    lanes->distance_to_facet[ll] = (x_facet) ? (edge_x - x) * speed * u_x_inv
+                                             : (edge_y - y) * speed * u_y_inv;
+  }
+}
+
+// Prefetches the data that the next event of a history is likely to load,
+// the density of the cell it is heading towards in y, as the cell in x is
+// usually on the same line, and its cell of a dense tally
+static inline void
+prefetch_history(const int nx, const int pad, const int x_off, const int y_off,
+                 const double* density, const Regions* regions,
+                 const Tally* tally, const History* state) {
+
+  const Particle* particle = state->particle;
+  if (!regions) {
+    const int celly =
+        particle->celly - y_off + pad + ((particle->omega_y > 0.0) ? 1 : -1);
+    __builtin_prefetch(
+        &density[celly * (nx + 2 * pad) + particle->cellx - x_off + pad]);
+  }
+
+  // The other tallies are held in the thread's own buffers, or are too
+  // sparse for the entry to be found without probing
+  if (tally->mode == TALLY_DENSE) {
+    __builtin_prefetch(&tally->energy_deposition[tally_cell_index(
+                           x_off, y_off, particle->cellx, particle->celly,
+                           tally)],
+                       1);
+  }
+}
+
+// Ends a history that is in flight, caching its transport state in the
+// particle, and either suspends it or records its statistics
+static inline void finish_history(const int x_off, const int y_off,
+                                  const double inv_ntotal_particles,
+                                  Tally* tally, Schedule* schedule,
+                                  uint64_t* history_stats, double* cost_sums,
+                                  const History* state, const int result,
+                                  uint64_t* nalive, uint64_t* nsuspended) {
+
+  // Cache the transport state for the next timestep
+  Particle* particle = state->particle;
+  particle->scatter_cs_index = state->scatter_cs_index;
+  particle->absorb_cs_index = state->absorb_cs_index;
+  particle->microscopic_cs_scatter = state->microscopic_cs_scatter;
+  particle->microscopic_cs_absorb = state->microscopic_cs_absorb;
+  particle->speed = state->speed;
+
+  COUNT_EVENTS(COUNT_RNG_DRAWS, state->counter - state->first_counter);
+
+  // The deposition held for the current cell is tallied before the
+  // particle is handed over
+  if (result == PARTICLE_SUSPENDED) {
+    update_tallies(x_off, y_off, particle->cellx, particle->celly,
+                   inv_ntotal_particles, state->energy_deposition, tally);
+    suspend_history(schedule, state->pid, state->counter, state->nevents,
+                    omp_get_wtime() - state->start_time);
+    (*nsuspended)++;
+  } else {
+    *nalive += !particle->dead;
+    if (state->sample_cycles) {
+      COUNT_EVENTS(COUNT_SAMPLED_HISTORIES, 1);
+      COUNT_EVENTS(COUNT_SAMPLED_CYCLES,
+                   read_cycle_counter() - state->start_cycles);
+    }
+    if (history_stats) {
+      record_history(history_stats, state->nevents,
+                     (uint64_t)((omp_get_wtime() - state->start_time) * 1.0e9));
+    }
+    if (cost_sums) {
+      record_history_cost(schedule, cost_sums, schedule->bins[state->pid],
+                          state->nevents);
+    }
+  }
+}
+
+// Tracks the histories of a thread with several of them in flight, taking
+// an event from each in turn so that the loads of one history are overlapped
+// with the events of the others
+static void track_histories_in_flight(
+    const int global_nx, const int global_ny, const int nx, const int ny,
+    const uint64_t master_key, const int pad, const int x_off, const int y_off,
+    const int initial, const double dt, const int* neighbours,
+    const double* density, const double* edgex, const double* edgey,
+    const int ntotal_particles, const double inv_ntotal_particles,
+    const int first_particle, const int nparticles_to_process,
+    const int particles_off, const int nown_particles, const int* order,
+    int* next_history, Particle* particles, int* nbanked,
+    const CrossSection* cs_scatter_table, const CrossSection* cs_absorb_table,
+    const Regions* regions, Tally* tally,
+    const VarianceReduction* variance_reduction, Schedule* schedule,
+    Tracer* tracer, const int cycle_interval, uint64_t* history_stats,
+    double* cost_sums, double* chunk_begin, uint64_t* nfacets,
+    uint64_t* ncollisions, uint64_t* nparticles, uint64_t* nroulette_kills,
+    uint64_t* nsplits, uint64_t* nalive, uint64_t* nsuspended) {
+
+  const int dynamic = schedule->lpt;
+  const int event_budget = schedule->event_budget;
+  const int interleave = schedule->interleave;
+  const int lockstep = schedule->lockstep;
+
+  History in_flight[MAX_INTERLEAVE];
+  Lanes lanes;
+  int nflight = 0;
+
+  int claimed = 0;
+  int claimed_end = 0;
+  int own_done = 0;
+  int exhausted = 0;
+  int pp = 0;
+  while (1) {
+
+    // Start histories in the free slots
+    while (nflight < interleave && !exhausted) {
+      int history = particles_off - first_particle + pp;
+      if (dynamic && !own_done) {
+        if (claimed == claimed_end) {
+#pragma omp atomic capture
+          {
+            claimed = *next_history;
+            *next_history += schedule->chunk;
+          }
+          claimed_end = min(claimed + schedule->chunk, nparticles_to_process);
+        }
+        own_done = (claimed >= nparticles_to_process);
+        history = claimed++;
+      } else if (!own_done) {
+        own_done = (pp == nown_particles);
+      }
+
+      // Once its own histories are finished, the thread resumes those that
+      // other threads suspended, one at a time once it has none in flight
+      SuspendedHistory resumed;
+      if (own_done) {
+        if (nflight) {
+          break;
+        }
+        if (!event_budget || !resume_history(schedule, &resumed)) {
+          exhausted = 1;
+          break;
+        }
+      }
+
+      // Record the thread's progress through its particles in chunks
+      if (pp && pp % TRACE_CHUNK_HISTORIES == 0) {
+        const double chunk_end = trace_time();
+        trace_event(tracer, "histories", *chunk_begin, chunk_end);
+        *chunk_begin = chunk_end;
+      }
+
+      // Current particle
+      const int pid =
+          (own_done) ? resumed.pid
+                     : first_particle + ((order) ? order[history] : history);
+
+      if (particles[pid].dead) {
+        pp++;
+        continue;
+      }
+
+      if (!own_done) {
+        (*nparticles)++;
+        COUNT_EVENTS(COUNT_HISTORIES, 1);
+      }
+
+      History* state = &in_flight[nflight++];
+      start_history(nx, pad, x_off, y_off, initial, dt, master_key, density,
+                    regions, cs_scatter_table, cs_absorb_table, particles, pid,
+                    (own_done) ? &resumed : NULL, event_budget, state);
+
+      // Sample the cycles taken by a subset of the histories, where a
+      // sample is dropped if its history is suspended. The cycles and time
+      // of an interleaved history include those of the histories
+      // interleaved with it
+      state->sample_cycles =
+          (!own_done && cycle_interval && pp % cycle_interval == 0);
+      state->start_cycles = (state->sample_cycles) ? read_cycle_counter() : 0;
+      state->start_time =
+          (history_stats || event_budget)
+              ? omp_get_wtime() - ((own_done) ? resumed.seconds : 0.0)
+              : 0.0;
+      pp++;
+    }
+
+    if (!nflight) {
+      break;
+    }
+
+    // The thread moves to the next history after each event, and the last
+    // history in flight, which has already taken its event, takes the slot
+    // of a history that finishes. In lockstep the next facet of every history
+    // is found first, and then each history takes its event
+    if (lockstep) {
+      find_next_facets(nflight, in_flight, pad, x_off, y_off, edgex, edgey,
+                       regions, &lanes);
+      for (int hh = nflight - 1; hh >= 0; --hh) {
+        History* state = &in_flight[hh];
+        int result = PARTICLE_CENSUS;
+        if (state->particle->dt_to_census > 0.0) {
+          result = handle_event(
+              global_nx, global_ny, nx, ny, master_key, pad, x_off, y_off,
+              neighbours, density, edgex, edgey, ntotal_particles,
+              inv_ntotal_particles, particles, nbanked, cs_scatter_table,
+              cs_absorb_table, regions, tally, variance_reduction, state,
+              nfacets, ncollisions, nroulette_kills, nsplits,
+              lanes.cell_mfp[hh], lanes.distance_to_facet[hh],
+              lanes.x_facet[hh], lanes.reflect[hh]);
+        }
+        if (result != PARTICLE_CONTINUE) {
+          finish_history(x_off, y_off, inv_ntotal_particles, tally, schedule,
+                         history_stats, cost_sums, state, result, nalive,
+                         nsuspended);
+          in_flight[hh] = in_flight[--nflight];
+        }
+      }
+    } else {
+      for (int hh = nflight - 1; hh >= 0; --hh) {
+        History* state = &in_flight[hh];
+        const int result = track_event(
+            global_nx, global_ny, nx, ny, master_key, pad, x_off, y_off,
+            neighbours, density, edgex, edgey, ntotal_particles,
+            inv_ntotal_particles, particles, nbanked, cs_scatter_table,
+            cs_absorb_table, regions, tally, variance_reduction, state,
+            nfacets, ncollisions, nroulette_kills, nsplits);
+        if (result == PARTICLE_CONTINUE) {
+          prefetch_history(nx, pad, x_off, y_off, density, regions, tally,
+                           state);
+        } else {
+          finish_history(x_off, y_off, inv_ntotal_particles, tally, schedule,
+                         history_stats, cost_sums, state, result, nalive,
+                         nsuspended);
+          in_flight[hh] = in_flight[--nflight];
+        }
+      }
+    }
+  }
 }
 
 // Handles the current active batch of particles
@@ -48,181 +711,633 @@ void handle_particles(const int global_nx, const int global_ny, const int nx,
                       const double* edgey, const double* edgedx,
                       const double* edgedy, uint64_t* facets,
                       uint64_t* collisions, const int ntotal_particles,
-                      const int nparticles_to_process,
-                      Particle* particles_start, CrossSection* cs_scatter_table,
-                      CrossSection* cs_absorb_table,
-                      double* energy_deposition_tally) {
-
-  int nthreads = 0;
-#pragma omp parallel
-  { nthreads = omp_get_num_threads(); }
+                      const int first_particle,
+                      const int nparticles_to_process, Particle* particles,
+                      int* nbanked, uint64_t* nlive,
+                      CrossSection* cs_scatter_table,
+                      CrossSection* cs_absorb_table, const Regions* regions,
+                      Tally* tally,
+                      const VarianceReduction* variance_reduction,
+                      Schedule* schedule, EventCounters* counters,
+                      Tracer* tracer) {
+
+  // Small sweeps, such as those over a few secondaries, are shared between
+  // fewer threads rather than waking the whole team
+  const int nthreads =
+      max(1, min(omp_get_max_threads(),
+                 nparticles_to_process / MIN_PARTICLES_PER_THREAD));
 
   uint64_t nfacets = 0;
   uint64_t ncollisions = 0;
   uint64_t nparticles = 0;
+  uint64_t nroulette_kills = 0;
+  uint64_t nsplits = 0;
+  uint64_t nalive = 0;
+  uint64_t nsuspended = 0;
 
   const int np_per_thread = nparticles_to_process / nthreads;
   const int np_remainder = nparticles_to_process % nthreads;
 
+  // Threads claim chunks of the histories when they are scheduled
+  // dynamically, following the order of their predicted cost in the sweep
+  // that starts the step
+  const int dynamic = schedule->lpt;
+  const int* order = (schedule->lpt && initial) ? schedule->order : NULL;
+  int next_history = 0;
+  const int event_budget = schedule->event_budget;
+  const int interleave = schedule->interleave;
+  const int lockstep = schedule->lockstep;
+  const double inv_ntotal_particles = 1.0 / (double)ntotal_particles;
+
 // The main particle loop
-#pragma omp parallel reduction(+ : nfacets, ncollisions, nparticles)
+#pragma omp parallel num_threads(nthreads)                                     \
+    reduction(+ : nfacets, ncollisions, nparticles, nroulette_kills, nsplits,  \
+              nalive, nsuspended)
   {
     const int tid = omp_get_thread_num();
+    thread_counters = (counters->enabled)
+                          ? &counters->counts[tid * EVENT_COUNTER_STRIDE]
+                          : NULL;
+    const int cycle_interval = counters->cycle_sample_interval;
+    uint64_t* history_stats =
+        (counters->history_stats)
+            ? &counters->history_stats[tid * HISTORY_STRIDE]
+            : NULL;
+    double* cost_sums =
+        (order) ? &schedule->thread_sums[tid * COST_STRIDE] : NULL;
 
     // Calculate the particles offset, accounting for some remainder
     const int rem = (tid < np_remainder);
-    const int particles_off = tid * np_per_thread + min(tid, np_remainder);
+    const int particles_off =
+        first_particle + tid * np_per_thread + min(tid, np_remainder);
 
-    int result = PARTICLE_CONTINUE;
+    double chunk_begin = trace_time();
 
-    for (int pp = 0; pp < np_per_thread + rem; ++pp) {
-      // (1) particle can stream and reach census
-      // (2) particle can collide and either
-      //      - the particle will be absorbed
-      //      - the particle will scatter (this means the energy changes)
-      // (3) particle encounters boundary region, transports to another cell
+    // A thread may suspend histories until it has resumed its last one
+    if (event_budget) {
+#pragma omp atomic update
+      schedule->nworking++;
+    }
 
-      // Current particle
-      const int pid = particles_off + pp;
-      Particle* particle = &particles_start[pid];
+    // Histories are kept in flight when they are interleaved or tracked in
+    // lockstep, otherwise each history is tracked to its end in turn
+    if (interleave > 1 || lockstep) {
+      track_histories_in_flight(
+          global_nx, global_ny, nx, ny, master_key, pad, x_off, y_off, initial,
+          dt, neighbours, density, edgex, edgey, ntotal_particles,
+          inv_ntotal_particles, first_particle, nparticles_to_process,
+          particles_off, np_per_thread + rem, order, &next_history, particles,
+          nbanked, cs_scatter_table, cs_absorb_table, regions, tally,
+          variance_reduction, schedule, tracer, cycle_interval, history_stats,
+          cost_sums, &chunk_begin, &nfacets, &ncollisions, &nparticles,
+          &nroulette_kills, &nsplits, &nalive, &nsuspended);
+    } else {
+      int result = PARTICLE_CONTINUE;
+      int claimed = 0;
+      int claimed_end = 0;
+      int own_done = 0;
+      for (int pp = 0;; ++pp) {
+        int history = particles_off - first_particle + pp;
+        if (dynamic && !own_done) {
+          if (claimed == claimed_end) {
+#pragma omp atomic capture
+            {
+              claimed = next_history;
+              next_history += schedule->chunk;
+            }
+            claimed_end = min(claimed + schedule->chunk, nparticles_to_process);
+          }
+          own_done = (claimed >= nparticles_to_process);
+          history = claimed++;
+        } else if (!own_done) {
+          own_done = (pp == np_per_thread + rem);
+        }
 
-      const uint64_t pkey = pid;
+        // Once its own histories are finished, the thread resumes those that
+        // other threads suspended
+        SuspendedHistory resumed = {0};
+        if (own_done &&
+            (!event_budget || !resume_history(schedule, &resumed))) {
+          break;
+        }
 
-      if (particle->dead) {
-        continue;
-      }
+        // Record the thread's progress through its particles in chunks
+        if (pp && pp % TRACE_CHUNK_HISTORIES == 0) {
+          const double chunk_end = trace_time();
+          trace_event(tracer, "histories", chunk_begin, chunk_end);
+          chunk_begin = chunk_end;
+        }
 
-      nparticles++;
-
-      int x_facet = 0;
-      int absorb_cs_index = -1;
-      int scatter_cs_index = -1;
-      double cell_mfp = 0.0;
-
-      // Determine the current cell
-      int cellx = particle->cellx - x_off + pad;
-      int celly = particle->celly - y_off + pad;
-      double local_density = density[celly * (nx + 2 * pad) + cellx];
-
-      // Fetch the cross sections and prepare related quantities
-      double microscopic_cs_scatter = microscopic_cs_for_energy(
-          cs_scatter_table, particle->energy, &scatter_cs_index);
-      double microscopic_cs_absorb = microscopic_cs_for_energy(
-          cs_absorb_table, particle->energy, &absorb_cs_index);
-      double number_density = (local_density * AVOGADROS / MOLAR_MASS);
-      double macroscopic_cs_scatter =
-          number_density * microscopic_cs_scatter * BARNS;
-      double macroscopic_cs_absorb =
-          number_density * microscopic_cs_absorb * BARNS;
-      double speed = sqrt((2.0 * particle->energy * eV_TO_J) / PARTICLE_MASS);
-      double energy_deposition = 0.0;
-
-      const double inv_ntotal_particles = 1.0 / (double)ntotal_particles;
-
-      uint64_t counter = 0;
-      double rn[NRANDOM_NUMBERS];
-
-      // Set time to census and MFPs until collision, unless travelled
-      // particle
-      if (initial) {
-        particle->dt_to_census = dt;
-        generate_random_numbers(pkey, master_key, counter++, &rn[0], &rn[1]);
-        particle->mfp_to_collision = -log(rn[0]) / macroscopic_cs_scatter;
-      }
+        // (1) particle can stream and reach census
+        // (2) particle can collide and either
+        //      - the particle will be absorbed
+        //      - the particle will scatter (this means the energy changes)
+        // (3) particle encounters boundary region, transports to another cell
 
-      // Loop until we have reached census
-      while (particle->dt_to_census > 0.0) {
-        cell_mfp = 1.0 / (macroscopic_cs_scatter + macroscopic_cs_absorb);
-
-        // Work out the distance until the particle hits a facet
-        double distance_to_facet = 0.0;
-        calc_distance_to_facet(global_nx, particle->x, particle->y, pad, x_off,
-                               y_off, particle->omega_x, particle->omega_y,
-                               speed, particle->cellx, particle->celly,
-                               &distance_to_facet, &x_facet, edgex, edgey);
-
-        const double distance_to_collision =
-            particle->mfp_to_collision * cell_mfp;
-        const double distance_to_census = speed * particle->dt_to_census;
-
-        // Check if our next event is a collision
-        if (distance_to_collision < distance_to_facet &&
-            distance_to_collision < distance_to_census) {
-
-          // Track the total number of collisions
-          ncollisions++;
-
-          // Handles a collision event
-          result = collision_event(
-              global_nx, nx, x_off, y_off, pid, master_key,
-              inv_ntotal_particles, distance_to_collision, local_density,
-              cs_scatter_table, cs_absorb_table, particle, &counter,
-              &energy_deposition, &number_density, &microscopic_cs_scatter,
-              &microscopic_cs_absorb, &macroscopic_cs_scatter,
-              &macroscopic_cs_absorb, energy_deposition_tally,
-              &scatter_cs_index, &absorb_cs_index, rn, &speed);
-
-          if (result != PARTICLE_CONTINUE) {
-            break;
-          }
+        // Current particle
+        const int pid =
+            (own_done) ? resumed.pid
+                       : first_particle + ((order) ? order[history] : history);
+        Particle* particle = &particles[pid];
+
+        const uint64_t pkey = particle->key;
+
+        if (particle->dead) {
+          continue;
         }
-        // Check if we have reached facet
-        else if (distance_to_facet < distance_to_census) {
 
-          // Track the number of fact encounters
-          nfacets++;
+        if (!own_done) {
+          nparticles++;
+          COUNT_EVENTS(COUNT_HISTORIES, 1);
+        }
 
-          result = facet_event(
-              global_nx, global_ny, nx, ny, x_off, y_off, inv_ntotal_particles,
-              distance_to_facet, speed, cell_mfp, x_facet, density, neighbours,
-              particle, &energy_deposition, &number_density,
-              &microscopic_cs_scatter, &microscopic_cs_absorb,
-              &macroscopic_cs_scatter, &macroscopic_cs_absorb,
-              energy_deposition_tally, &cellx, &celly, &local_density);
+        // Histories are split into batches by particle for the tally variance
+        if (tally->nbatches) {
+          thread_batch = pkey % tally->nbatches;
+        }
+
+        // Sample the cycles taken by a subset of the histories, where a sample
+        // is dropped if its history is suspended
+        const int sample_cycles =
+            (!own_done && cycle_interval && pp % cycle_interval == 0);
+        const uint64_t start_cycles =
+            (sample_cycles) ? read_cycle_counter() : 0;
+
+        // The facet and collision events and time taken by each history,
+        // including those before it was suspended
+        const uint64_t start_events = nfacets + ncollisions - resumed.nevents;
+        const double start_time =
+            (history_stats || event_budget) ? omp_get_wtime() - resumed.seconds
+                                            : 0.0;
+
+        int x_facet = 0;
+        int reflect = NO_REFLECTION;
+        double cell_mfp = 0.0;
+
+        // Determine the current cell, and the density of the region the
+        // particle is in when we are tracking against region boundaries
+        int cellx = particle->cellx - x_off + pad;
+        int celly = particle->celly - y_off + pad;
+        double local_density =
+            (regions) ? region_density(regions, particle->x, particle->y)
+                      : density[celly * (nx + 2 * pad) + cellx];
+
+        // Particles carried over from census keep their cross sections and
+        // speed, so only new particles need to look them up
+        const int untracked = (particle->scatter_cs_index == -1);
+        if (untracked) {
+          particle->microscopic_cs_scatter = microscopic_cs_for_energy(
+              cs_scatter_table, particle->energy, &particle->scatter_cs_index);
+          particle->microscopic_cs_absorb = microscopic_cs_for_energy(
+              cs_absorb_table, particle->energy, &particle->absorb_cs_index);
+          particle->speed =
+              sqrt((2.0 * particle->energy * eV_TO_J) / PARTICLE_MASS);
+        }
+        int scatter_cs_index = particle->scatter_cs_index;
+        int absorb_cs_index = particle->absorb_cs_index;
+        double microscopic_cs_scatter = particle->microscopic_cs_scatter;
+        double microscopic_cs_absorb = particle->microscopic_cs_absorb;
+        double speed = particle->speed;
+        double number_density = (local_density * AVOGADROS / MOLAR_MASS);
+        double macroscopic_cs_scatter =
+            number_density * microscopic_cs_scatter * BARNS;
+        double macroscopic_cs_absorb =
+            number_density * microscopic_cs_absorb * BARNS;
+        double energy_deposition = 0.0;
+
+
+        uint64_t counter = resumed.counter;
+        double rn[NRANDOM_NUMBERS];
+
+        // Set time to census and MFPs until collision, unless travelled
+        // particle. The MFPs are sampled against the local cross section, so
+        // are sampled again rather than carried over from census
+        if (initial && !own_done) {
+          particle->dt_to_census = dt;
+          generate_random_numbers(pkey, master_key, counter++, &rn[0], &rn[1]);
+          particle->mfp_to_collision = -log(rn[0]) / macroscopic_cs_scatter;
+        }
+
+        // Loop until we have reached census
+        int suspend = 0;
+        while (particle->dt_to_census > 0.0) {
+          cell_mfp = 1.0 / (macroscopic_cs_scatter + macroscopic_cs_absorb);
+
+          // Work out the distance until the particle hits a facet, or a region
+          // boundary if the mesh is only being used for tallies
+          double distance_to_facet = 0.0;
+          if (regions) {
+            calc_distance_to_region_boundary(
+                regions, particle->x, particle->y, particle->omega_x,
+                particle->omega_y, &distance_to_facet, &reflect);
+          } else {
+            calc_distance_to_facet(
+                global_nx, particle->x, particle->y, pad, x_off, y_off,
+                particle->omega_x, particle->omega_y, speed, particle->cellx,
+                particle->celly, &distance_to_facet, &x_facet, edgex, edgey);
+          }
+
+          const double distance_to_collision =
+              particle->mfp_to_collision * cell_mfp;
+          const double distance_to_census = speed * particle->dt_to_census;
+
+          // Check if our next event is a collision
+          if (distance_to_collision < distance_to_facet &&
+              distance_to_collision < distance_to_census) {
+
+            // Track the total number of collisions
+            ncollisions++;
+            COUNT_EVENTS(COUNT_COLLISIONS, 1);
+
+            // Handles a collision event
+            result = collision_event(
+                global_nx, global_ny, nx, pad, x_off, y_off, pkey, master_key,
+                inv_ntotal_particles, distance_to_collision, local_density,
+                cs_scatter_table, cs_absorb_table, regions, edgex, edgey,
+                particle, &counter, &energy_deposition, &number_density,
+                &microscopic_cs_scatter, &microscopic_cs_absorb,
+                &macroscopic_cs_scatter, &macroscopic_cs_absorb, tally,
+                variance_reduction, &scatter_cs_index, &absorb_cs_index, rn,
+                &speed);
+
+            if (result != PARTICLE_CONTINUE) {
+              COUNT_EVENTS(COUNT_DEATHS, (result == PARTICLE_DEAD));
+
+              // Particles above the energy cut off can only die in roulette
+              nroulette_kills += (result == PARTICLE_DEAD &&
+                                  particle->energy >= MIN_ENERGY_OF_INTEREST);
+              break;
+            }
+          }
+          // Check if we have reached facet
+          else if (distance_to_facet < distance_to_census) {
+
+            // Track the number of fact encounters
+            nfacets++;
+            COUNT_EVENTS(COUNT_FACETS, 1);
+
+            if (regions) {
+              result = region_event(
+                  global_nx, global_ny, nx, pad, x_off, y_off,
+                  inv_ntotal_particles, distance_to_facet, speed, cell_mfp,
+                  reflect, regions, edgex, edgey, particle, &energy_deposition,
+                  &number_density, &microscopic_cs_scatter,
+                  &microscopic_cs_absorb, &macroscopic_cs_scatter,
+                  &macroscopic_cs_absorb, tally, &local_density);
+            } else {
+              result = facet_event(
+                  global_nx, global_ny, nx, ny, x_off, y_off,
+                  inv_ntotal_particles, distance_to_facet, speed, cell_mfp,
+                  x_facet, density, neighbours, particle, &energy_deposition,
+                  &number_density, &microscopic_cs_scatter,
+                  &microscopic_cs_absorb, &macroscopic_cs_scatter,
+                  &macroscopic_cs_absorb, tally, &cellx, &celly,
+                  &local_density);
+            }
+
+            if (result != PARTICLE_CONTINUE) {
+              break;
+            }
+
+          } else {
+
+            census_event(global_nx, global_ny, nx, pad, x_off, y_off,
+                         inv_ntotal_particles, distance_to_census, cell_mfp,
+                         regions, edgex, edgey, particle, &energy_deposition,
+                         &number_density, &microscopic_cs_scatter,
+                         &microscopic_cs_absorb, tally);
+            COUNT_EVENTS(COUNT_CENSUS, 1);
 
-          if (result != PARTICLE_CONTINUE) {
             break;
           }
 
-        } else {
+          // Check the particle against the window of the cell it is now in
+          if (variance_reduction->window_lower) {
+            result = weight_window_event(
+                x_off, y_off, pkey, master_key, ntotal_particles,
+                inv_ntotal_particles, variance_reduction, particle, &counter,
+                &energy_deposition, tally, particles, nbanked, &nsplits);
+
+            if (result != PARTICLE_CONTINUE) {
+              COUNT_EVENTS(COUNT_DEATHS, 1);
+              nroulette_kills++;
+              break;
+            }
+          }
+
+          // Stop a history that has used its event budget, so that an idle
+          // thread can resume it
+          if (event_budget &&
+              nfacets + ncollisions - start_events >=
+                  resumed.nevents + event_budget) {
+            suspend = 1;
+            break;
+          }
+        }
 
-          census_event(global_nx, nx, x_off, y_off, inv_ntotal_particles,
-                       distance_to_census, cell_mfp, particle,
-                       &energy_deposition, &number_density,
-                       &microscopic_cs_scatter, &microscopic_cs_absorb,
-                       energy_deposition_tally);
+        // Cache the transport state for the next timestep
+        particle->scatter_cs_index = scatter_cs_index;
+        particle->absorb_cs_index = absorb_cs_index;
+        particle->microscopic_cs_scatter = microscopic_cs_scatter;
+        particle->microscopic_cs_absorb = microscopic_cs_absorb;
+        particle->speed = speed;
+
+        COUNT_EVENTS(COUNT_RNG_DRAWS, counter - resumed.counter);
+
+        // The deposition held for the current cell is tallied before the
+        // particle is handed over
+        if (suspend) {
+          update_tallies(x_off, y_off, particle->cellx, particle->celly,
+                         inv_ntotal_particles, energy_deposition, tally);
+          suspend_history(schedule, pid, counter,
+                          nfacets + ncollisions - start_events,
+                          omp_get_wtime() - start_time);
+          nsuspended++;
+          continue;
+        }
 
-          break;
+        nalive += !particle->dead;
+        if (sample_cycles) {
+          COUNT_EVENTS(COUNT_SAMPLED_HISTORIES, 1);
+          COUNT_EVENTS(COUNT_SAMPLED_CYCLES,
+                       read_cycle_counter() - start_cycles);
+        }
+        if (history_stats) {
+          record_history(history_stats, nfacets + ncollisions - start_events,
+                         (uint64_t)((omp_get_wtime() - start_time) * 1.0e9));
+        }
+        if (cost_sums) {
+          record_history_cost(schedule, cost_sums, schedule->bins[pid],
+                              nfacets + ncollisions - start_events);
         }
       }
+
     }
+
+    const double flush_begin = trace_time();
+    trace_event(tracer, "histories", chunk_begin, flush_begin);
+
+    // Release the rest of the block this thread reserved for secondaries
+    release_secondaries(particles);
+
+    // Flush any deposition that this thread is holding back from the tally
+    flush_tally(tally);
+    thread_counters = NULL;
+    trace_event(tracer, "flush_tally", flush_begin, trace_time());
   }
 
   // Store a total number of facets and collisions
   *facets += nfacets;
   *collisions += ncollisions;
+  *nlive += nalive;
+
+  if (event_budget) {
+    printf("Suspended histories %" PRIu64 "\n", nsuspended);
+  }
 
   printf("Particles  %llu\n", nparticles);
+  if (variance_reduction->weight_cutoff > 0.0 ||
+      variance_reduction->window_lower) {
+    printf("Roulette kills %" PRIu64 "\n", nroulette_kills);
+  }
+  if (variance_reduction->window_lower) {
+    printf("Window splits %" PRIu64 "\n", nsplits);
+  }
+}
+
+// Plays roulette with a particle below the weight window of its cell, and
+// splits a particle above the window into copies that are banked to be
+// tracked in a later sweep
+inline int weight_window_event(
+    const int x_off, const int y_off, const uint64_t pkey,
+    const uint64_t master_key, const int ntotal_particles,
+    const double inv_ntotal_particles,
+    const VarianceReduction* variance_reduction, Particle* particle,
+    uint64_t* counter, double* energy_deposition, Tally* tally,
+    Particle* particles, int* nbanked, uint64_t* nsplits) {
+
+  const int window_cellx =
+      ((particle->cellx - x_off) * variance_reduction->window_nx) /
+      variance_reduction->window_mesh_nx;
+  const int window_celly =
+      ((particle->celly - y_off) * variance_reduction->window_ny) /
+      variance_reduction->window_mesh_ny;
+  const double lower =
+      variance_reduction->window_lower[window_celly *
+                                           variance_reduction->window_nx +
+                                       window_cellx];
+  if (lower <= 0.0) {
+    return PARTICLE_CONTINUE;
+  }
+
+  if (particle->weight < lower) {
+    const double survival_weight =
+        lower * variance_reduction->window_survival_ratio;
+    double rn[NRANDOM_NUMBERS];
+    generate_random_numbers(pkey, master_key, (*counter)++, &rn[0], &rn[1]);
+    if (rn[0] * survival_weight < particle->weight) {
+      particle->weight = survival_weight;
+      return PARTICLE_CONTINUE;
+    }
+
+    // The particle lost the roulette, so tally what it holds and kill it
+    particle->dead = 1;
+    update_tallies(x_off, y_off, particle->cellx, particle->celly,
+                   inv_ntotal_particles, *energy_deposition, tally);
+    *energy_deposition = 0.0;
+    return PARTICLE_DEAD;
+  }
+
+  const double upper = lower * variance_reduction->window_upper_ratio;
+  if (particle->weight <= upper) {
+    return PARTICLE_CONTINUE;
+  }
+
+  // Each copy takes its own random number stream, and looks up its cross
+  // sections again as the cache is only written back at the end of the
+  // history, while the particle keeps the weight of any copies that the bank
+  // has no room for. Each split consumes a draw of the parent's stream, as
+  // facets draw none, so that splits at successive facets key their copies
+  // differently
+  const int ncopies = min((int)ceil(particle->weight / upper),
+                          variance_reduction->window_max_split) -
+                      1;
+  const double copy_weight = particle->weight / (ncopies + 1);
+  const uint64_t split_counter = (*counter)++;
+  int nstaged = 0;
+  for (int cc = 0; cc < ncopies; ++cc) {
+    Particle secondary = *particle;
+    secondary.weight = copy_weight;
+    secondary.key = secondary_key(pkey, split_counter, cc);
+    secondary.scatter_cs_index = -1;
+    secondary.absorb_cs_index = -1;
+    nstaged += stage_secondary(&secondary, particles, nbanked,
+                               PARTICLE_BANK_FACTOR * ntotal_particles);
+  }
+  particle->weight -= nstaged * copy_weight;
+  *nsplits += (nstaged > 0);
+
+  return PARTICLE_CONTINUE;
+}
+
+// Derives the random number key of a secondary from its parent's key and the
+// point in the parent's history that produced it, so that the secondary's
+// stream does not depend on the order in which secondaries are banked
+inline uint64_t secondary_key(const uint64_t parent_key, const uint64_t counter,
+                              const int copy) {
+
+  // Mixes the inputs with the splitmix64 finaliser, and sets the top bit so
+  // that secondaries never share a stream with a source particle
+  uint64_t key = parent_key ^ (counter << 32) ^ ((uint64_t)copy << 56);
+  key += 0x9e3779b97f4a7c15ULL;
+  key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+  return (key ^ (key >> 31)) | (1ULL << 63);
+}
+
+// Stages a secondary in the block of the bank reserved by the calling thread,
+// reserving a new block when it is full, and returns 0 if the bank is full
+inline int stage_secondary(const Particle* secondary, Particle* particles,
+                           int* nbanked, const int capacity) {
+
+  if (thread_secondary_slot == thread_secondary_end) {
+    int slot;
+#pragma omp atomic capture
+    {
+      slot = *nbanked;
+      *nbanked += SECONDARY_STAGING_SIZE;
+    }
+    thread_secondary_slot = min(slot, capacity);
+    thread_secondary_end = min(slot + SECONDARY_STAGING_SIZE, capacity);
+    if (thread_secondary_slot == thread_secondary_end) {
+      return 0;
+    }
+  }
+
+  particles[thread_secondary_slot++] = *secondary;
+  return 1;
+}
+
+// Marks the unused slots of the calling thread's reserved block as dead, so
+// that later sweeps skip them
+void release_secondaries(Particle* particles) {
+
+  for (int ii = thread_secondary_slot; ii < thread_secondary_end; ++ii) {
+    particles[ii].dead = 1;
+  }
+  thread_secondary_slot = 0;
+  thread_secondary_end = 0;
+}
+
+// Suspends a history that has used its event budget at the tail of the ring,
+// for any thread to resume
+void suspend_history(Schedule* schedule, const int pid, const uint64_t counter,
+                     const uint64_t nevents, const double seconds) {
+
+  int64_t position;
+#pragma omp atomic capture
+  position = schedule->suspended_tail++;
+
+  // The entry may still be being read by the thread resuming its last history
+  SuspendedHistory* entry = &schedule->suspended[position % schedule->capacity];
+  while (1) {
+    int64_t sequence;
+#pragma omp atomic read
+    sequence = entry->sequence;
+    if (sequence == position) {
+      break;
+    }
+    SPIN_PAUSE();
+  }
+
+  entry->pid = pid;
+  entry->counter = counter;
+  entry->nevents = nevents;
+  entry->seconds = seconds;
+#pragma omp flush
+#pragma omp atomic write
+  entry->sequence = position + 1;
+}
+
+// Resumes a suspended history once the calling thread has finished its last
+// history, returning 0 when no thread is left that could suspend another
+int resume_history(Schedule* schedule, SuspendedHistory* resumed) {
+
+#pragma omp atomic update
+  schedule->nworking--;
+
+  while (1) {
+    // The working threads are read first, as a thread only stops working
+    // after it has suspended its history
+    int nworking;
+#pragma omp atomic read
+    nworking = schedule->nworking;
+    int64_t head;
+    int64_t tail;
+#pragma omp atomic read
+    head = schedule->suspended_head;
+#pragma omp atomic read
+    tail = schedule->suspended_tail;
+
+    // Other threads may still suspend a history, so give way to them
+    if (head == tail) {
+      if (!nworking) {
+        return 0;
+      }
+      sched_yield();
+      continue;
+    }
+
+    // The thread counts as working before it claims the history, so that the
+    // others do not leave while it is being resumed
+#pragma omp atomic update
+    schedule->nworking++;
+    if (__sync_bool_compare_and_swap(&schedule->suspended_head, head,
+                                     head + 1)) {
+      SuspendedHistory* entry =
+          &schedule->suspended[head % schedule->capacity];
+      while (1) {
+        int64_t sequence;
+#pragma omp atomic read
+        sequence = entry->sequence;
+        if (sequence == head + 1) {
+          break;
+        }
+        SPIN_PAUSE();
+      }
+#pragma omp flush
+      *resumed = *entry;
+#pragma omp flush
+#pragma omp atomic write
+      entry->sequence = head + schedule->capacity;
+      return 1;
+    }
+#pragma omp atomic update
+    schedule->nworking--;
+  }
 }
 
 // Handles a collision event
 inline int collision_event(
-    const int global_nx, const int nx, const int x_off, const int y_off,
-    const uint64_t pkey, const uint64_t master_key,
-    const double inv_ntotal_particles, const double distance_to_collision,
-    const double local_density, const CrossSection* cs_scatter_table,
-    const CrossSection* cs_absorb_table, Particle* particle, uint64_t* counter,
-    double* energy_deposition, double* number_density,
-    double* microscopic_cs_scatter, double* microscopic_cs_absorb,
-    double* macroscopic_cs_scatter, double* macroscopic_cs_absorb,
-    double* energy_deposition_tally, int* scatter_cs_index,
+    const int global_nx, const int global_ny, const int nx, const int pad,
+    const int x_off, const int y_off, const uint64_t pkey,
+    const uint64_t master_key, const double inv_ntotal_particles,
+    const double distance_to_collision, const double local_density,
+    const CrossSection* cs_scatter_table, const CrossSection* cs_absorb_table,
+    const Regions* regions, const double* edgex, const double* edgey,
+    Particle* particle, uint64_t* counter, double* energy_deposition,
+    double* number_density, double* microscopic_cs_scatter,
+    double* microscopic_cs_absorb, double* macroscopic_cs_scatter,
+    double* macroscopic_cs_absorb, Tally* tally,
+    const VarianceReduction* variance_reduction, int* scatter_cs_index,
     int* absorb_cs_index, double rn[NRANDOM_NUMBERS], double* speed) {
 
   // Energy deposition stored locally for collision, not in tally mesh
-  *energy_deposition += calculate_energy_deposition(
-      global_nx, nx, x_off, y_off, particle, inv_ntotal_particles,
+  deposit_energy_along_path(
+      global_nx, global_ny, nx, pad, x_off, y_off, inv_ntotal_particles,
       distance_to_collision, *number_density, *microscopic_cs_absorb,
-      *microscopic_cs_scatter + *microscopic_cs_absorb);
+      *microscopic_cs_scatter + *microscopic_cs_absorb, regions, edgex, edgey,
+      particle, energy_deposition, tally);
 
   // Moves the particle to the collision site
   particle->x += distance_to_collision * particle->omega_x;
@@ -240,13 +1355,26 @@ inline int collision_event(
     // Find the new particle weight after absorption, saving the energy change
     particle->weight *= (1.0 - p_absorb);
 
-    if (particle->energy < MIN_ENERGY_OF_INTEREST) {
-      // Energy is too low, so mark the particle for deletion
+    // Play roulette with low weight particles, using the random number that
+    // is otherwise only drawn for scattering, where the survivors' increased
+    // weight preserves the expected weight
+    int rouletted = 0;
+    if (particle->weight < variance_reduction->weight_cutoff) {
+      if (rn1[1] * variance_reduction->survival_weight < particle->weight) {
+        particle->weight = variance_reduction->survival_weight;
+      } else {
+        rouletted = 1;
+      }
+    }
+
+    if (particle->energy < MIN_ENERGY_OF_INTEREST || rouletted) {
+      // Energy is too low or roulette was lost, so mark the particle for
+      // deletion
       particle->dead = 1;
 
       // Need to store tally information as finished with particle
-      update_tallies(nx, x_off, y_off, particle, inv_ntotal_particles,
-                     *energy_deposition, energy_deposition_tally);
+      update_tallies(x_off, y_off, particle->cellx, particle->celly,
+                     inv_ntotal_particles, *energy_deposition, tally);
       *energy_deposition = 0.0;
       return PARTICLE_DEAD;
     }
@@ -309,8 +1437,7 @@ facet_event(const int global_nx, const int global_ny, const int nx,
             double* energy_deposition, double* number_density,
             double* microscopic_cs_scatter, double* microscopic_cs_absorb,
             double* macroscopic_cs_scatter, double* macroscopic_cs_absorb,
-            double* energy_deposition_tally, int* cellx, int* celly,
-            double* local_density) {
+            Tally* tally, int* cellx, int* celly, double* local_density) {
 
   // Update the mean free paths until collision
   particle->mfp_to_collision -= (distance_to_facet / cell_mfp);
@@ -321,10 +1448,8 @@ facet_event(const int global_nx, const int global_ny, const int nx,
       distance_to_facet, *number_density, *microscopic_cs_absorb,
       *microscopic_cs_scatter + *microscopic_cs_absorb);
 
-  // Update tallies as we leave a cell
-  update_tallies(nx, x_off, y_off, particle, inv_ntotal_particles,
-                 *energy_deposition, energy_deposition_tally);
-  *energy_deposition = 0.0;
+  const int cellx_left = particle->cellx;
+  const int celly_left = particle->celly;
 
   // Move the particle to the facet
   particle->x += distance_to_facet * particle->omega_x;
@@ -368,6 +1493,14 @@ facet_event(const int global_nx, const int global_ny, const int nx,
     }
   }
 
+  // Update tallies as we leave a tally cell, which can span several cells
+  if (tally_cell_index(x_off, y_off, particle->cellx, particle->celly, tally) !=
+      tally_cell_index(x_off, y_off, cellx_left, celly_left, tally)) {
+    update_tallies(x_off, y_off, cellx_left, celly_left, inv_ntotal_particles,
+                   *energy_deposition, tally);
+    *energy_deposition = 0.0;
+  }
+
   // Update the data based on new cell
   *cellx = particle->cellx - x_off;
   *celly = particle->celly - y_off;
@@ -381,42 +1514,451 @@ facet_event(const int global_nx, const int global_ny, const int nx,
 
 // Handles the census event
 inline void
-census_event(const int global_nx, const int nx, const int x_off,
-             const int y_off, const double inv_ntotal_particles,
-             const double distance_to_census, const double cell_mfp,
-             Particle* particle, double* energy_deposition,
+census_event(const int global_nx, const int global_ny, const int nx,
+             const int pad, const int x_off, const int y_off,
+             const double inv_ntotal_particles, const double distance_to_census,
+             const double cell_mfp, const Regions* regions, const double* edgex,
+             const double* edgey, Particle* particle, double* energy_deposition,
              double* number_density, double* microscopic_cs_scatter,
-             double* microscopic_cs_absorb, double* energy_deposition_tally) {
+             double* microscopic_cs_absorb, Tally* tally) {
 
-  // We have not changed cell or energy level at this stage
+  // We have not changed energy level at this stage, and will only have changed
+  // cell if we are tracking against region boundaries
+  deposit_energy_along_path(
+      global_nx, global_ny, nx, pad, x_off, y_off, inv_ntotal_particles,
+      distance_to_census, *number_density, *microscopic_cs_absorb,
+      *microscopic_cs_scatter + *microscopic_cs_absorb, regions, edgex, edgey,
+      particle, energy_deposition, tally);
   particle->x += distance_to_census * particle->omega_x;
   particle->y += distance_to_census * particle->omega_y;
   particle->mfp_to_collision -= (distance_to_census / cell_mfp);
-  *energy_deposition += calculate_energy_deposition(
-      global_nx, nx, x_off, y_off, particle, inv_ntotal_particles,
-      distance_to_census, *number_density, *microscopic_cs_absorb,
-      *microscopic_cs_scatter + *microscopic_cs_absorb);
 
   // Need to store tally information as finished with particle
-  update_tallies(nx, x_off, y_off, particle, inv_ntotal_particles,
-                 *energy_deposition, energy_deposition_tally);
+  update_tallies(x_off, y_off, particle->cellx, particle->celly,
+                 inv_ntotal_particles, *energy_deposition, tally);
 
   particle->dt_to_census = 0.0;
 }
 
+// Handles a particle crossing the boundary between two regions
+inline int
+region_event(const int global_nx, const int global_ny, const int nx,
+             const int pad, const int x_off, const int y_off,
+             const double inv_ntotal_particles,
+             const double distance_to_boundary, const double speed,
+             const double cell_mfp, const int reflect, const Regions* regions,
+             const double* edgex, const double* edgey, Particle* particle,
+             double* energy_deposition, double* number_density,
+             double* microscopic_cs_scatter, double* microscopic_cs_absorb,
+             double* macroscopic_cs_scatter, double* macroscopic_cs_absorb,
+             Tally* tally, double* local_density) {
+
+  // Update the mean free paths until collision
+  particle->mfp_to_collision -= (distance_to_boundary / cell_mfp);
+  particle->dt_to_census -= (distance_to_boundary / speed);
+
+  // Tallies every cell that is left on the way to the boundary
+  deposit_energy_along_path(
+      global_nx, global_ny, nx, pad, x_off, y_off, inv_ntotal_particles,
+      distance_to_boundary, *number_density, *microscopic_cs_absorb,
+      *microscopic_cs_scatter + *microscopic_cs_absorb, regions, edgex, edgey,
+      particle, energy_deposition, tally);
+
+  // Move the particle to the boundary
+  particle->x += distance_to_boundary * particle->omega_x;
+  particle->y += distance_to_boundary * particle->omega_y;
+
+  // Reflect at the edge of the domain
+  if (reflect == REFLECT_X) {
+    particle->omega_x = -(particle->omega_x);
+  } else if (reflect == REFLECT_Y) {
+    particle->omega_y = -(particle->omega_y);
+  }
+
+  // Update the data based on the region just across the boundary
+  *local_density = region_density(
+      regions, particle->x + OPEN_BOUND_CORRECTION * particle->omega_x,
+      particle->y + OPEN_BOUND_CORRECTION * particle->omega_y);
+  *number_density = (*local_density * AVOGADROS / MOLAR_MASS);
+  *macroscopic_cs_scatter = *number_density * *microscopic_cs_scatter * BARNS;
+  *macroscopic_cs_absorb = *number_density * *microscopic_cs_absorb * BARNS;
+
+  return PARTICLE_CONTINUE;
+}
+
+// Accumulates the energy deposited along a path, splitting it over the cells
+// that the path crosses when tracking against region boundaries
+inline void deposit_energy_along_path(
+    const int global_nx, const int global_ny, const int nx, const int pad,
+    const int x_off, const int y_off, const double inv_ntotal_particles,
+    const double path_length, const double number_density,
+    const double microscopic_cs_absorb, const double microscopic_cs_total,
+    const Regions* regions, const double* edgex, const double* edgey,
+    Particle* particle, double* energy_deposition, Tally* tally) {
+
+  if (!regions) {
+    *energy_deposition += calculate_energy_deposition(
+        global_nx, nx, x_off, y_off, particle, inv_ntotal_particles,
+        path_length, number_density, microscopic_cs_absorb,
+        microscopic_cs_total);
+    return;
+  }
+
+  // The deposition is linear in the path length inside of a region
+  const double deposition_per_length = calculate_energy_deposition(
+      global_nx, nx, x_off, y_off, particle, inv_ntotal_particles, 1.0,
+      number_density, microscopic_cs_absorb, microscopic_cs_total);
+
+  double x = particle->x;
+  double y = particle->y;
+  double remaining = path_length;
+
+  while (1) {
+    const int cellx = particle->cellx - x_off + pad;
+    const int celly = particle->celly - y_off + pad;
+
+    // The facets that the path is heading towards, ignoring the mesh edges
+    double distance_x = DBL_MAX;
+    double distance_y = DBL_MAX;
+    if (particle->omega_x > 0.0 && particle->cellx < global_nx - 1) {
+      distance_x = (edgex[cellx + 1] - x) / particle->omega_x;
+    } else if (particle->omega_x < 0.0 && particle->cellx > 0) {
+      distance_x = (edgex[cellx] - x) / particle->omega_x;
+    }
+    if (particle->omega_y > 0.0 && particle->celly < global_ny - 1) {
+      distance_y = (edgey[celly + 1] - y) / particle->omega_y;
+    } else if (particle->omega_y < 0.0 && particle->celly > 0) {
+      distance_y = (edgey[celly] - y) / particle->omega_y;
+    }
+
+    const double distance_to_facet = max(0.0, min(distance_x, distance_y));
+    if (distance_to_facet >= remaining) {
+      *energy_deposition += remaining * deposition_per_length;
+      break;
+    }
+
+    *energy_deposition += distance_to_facet * deposition_per_length;
+    remaining -= distance_to_facet;
+    x += distance_to_facet * particle->omega_x;
+    y += distance_to_facet * particle->omega_y;
+
+    const int cellx_left = particle->cellx;
+    const int celly_left = particle->celly;
+    if (distance_x <= distance_y) {
+      particle->cellx += (particle->omega_x > 0.0) ? 1 : -1;
+    } else {
+      particle->celly += (particle->omega_y > 0.0) ? 1 : -1;
+    }
+
+    // Update tallies as we leave a tally cell
+    if (tally_cell_index(x_off, y_off, particle->cellx, particle->celly,
+                         tally) !=
+        tally_cell_index(x_off, y_off, cellx_left, celly_left, tally)) {
+      update_tallies(x_off, y_off, cellx_left, celly_left,
+                     inv_ntotal_particles, *energy_deposition, tally);
+      *energy_deposition = 0.0;
+    }
+  }
+}
+
+// Calculate the distance to the next region boundary, or to the edge of the
+// domain where the particle will be reflected
+inline void calc_distance_to_region_boundary(
+    const Regions* regions, const double x, const double y,
+    const double omega_x, const double omega_y, double* distance_to_boundary,
+    int* reflect) {
+
+  // The edges of the domain bound the distance that can be travelled
+  const double distance_x =
+      (omega_x > 0.0) ? (regions->domain_width - x) / omega_x
+                      : (omega_x < 0.0) ? -x / omega_x : DBL_MAX;
+  const double distance_y =
+      (omega_y > 0.0) ? (regions->domain_height - y) / omega_y
+                      : (omega_y < 0.0) ? -y / omega_y : DBL_MAX;
+  *reflect = (distance_x < distance_y) ? REFLECT_X : REFLECT_Y;
+  *distance_to_boundary = max(0.0, min(distance_x, distance_y));
+
+  // Intersect the path with each of the region rectangles, only considering
+  // those boundaries that are strictly ahead of the particle
+  for (int rr = 0; rr < regions->nregions; ++rr) {
+    const double x0 = regions->xpos[rr];
+    const double y0 = regions->ypos[rr];
+    const double x1 = x0 + regions->width[rr];
+    const double y1 = y0 + regions->height[rr];
+
+    double distance_in = -DBL_MAX;
+    double distance_out = DBL_MAX;
+    if (omega_x != 0.0) {
+      const double distance_x0 = (x0 - x) / omega_x;
+      const double distance_x1 = (x1 - x) / omega_x;
+      distance_in = max(distance_in, min(distance_x0, distance_x1));
+      distance_out = min(distance_out, max(distance_x0, distance_x1));
+    } else if (x < x0 || x >= x1) {
+      continue;
+    }
+    if (omega_y != 0.0) {
+      const double distance_y0 = (y0 - y) / omega_y;
+      const double distance_y1 = (y1 - y) / omega_y;
+      distance_in = max(distance_in, min(distance_y0, distance_y1));
+      distance_out = min(distance_out, max(distance_y0, distance_y1));
+    } else if (y < y0 || y >= y1) {
+      continue;
+    }
+
+    if (distance_in >= distance_out) {
+      continue;
+    }
+
+    if (distance_in > OPEN_BOUND_CORRECTION &&
+        distance_in < *distance_to_boundary) {
+      *distance_to_boundary = distance_in;
+      *reflect = NO_REFLECTION;
+    } else if (distance_out > OPEN_BOUND_CORRECTION &&
+               distance_out < *distance_to_boundary) {
+      *distance_to_boundary = distance_out;
+      *reflect = NO_REFLECTION;
+    }
+  }
+}
+
+// Fetch the density of the region containing a point, where later problem
+// entries take precedence over earlier ones
+inline double region_density(const Regions* regions, const double x,
+                             const double y) {
+
+  for (int rr = regions->nregions - 1; rr >= 0; --rr) {
+    if (x >= regions->xpos[rr] && x < regions->xpos[rr] + regions->width[rr] &&
+        y >= regions->ypos[rr] &&
+        y < regions->ypos[rr] + regions->height[rr]) {
+      return regions->density[rr];
+    }
+  }
+  return 0.0;
+}
+
 // Tallies the energy deposition in the cell
-inline void update_tallies(const int nx, const int x_off,
-                                  const int y_off, Particle* particle,
-                                  const double inv_ntotal_particles,
-                                  const double energy_deposition,
-                                  double* energy_deposition_tally) {
+inline void update_tallies(const int x_off, const int y_off,
+                           const int p_cellx, const int p_celly,
+                           const double inv_ntotal_particles,
+                           const double energy_deposition, Tally* tally) {
+
+  const int index = tally_cell_index(x_off, y_off, p_cellx, p_celly, tally);
+  const double value = energy_deposition * inv_ntotal_particles;
+
+  if (tally->nbatches) {
+    batch_tally(tally, index, value);
+  }
+
+  if (tally->mode == TALLY_SPARSE) {
+    stage_sparse_tally(tally, index, value);
+    return;
+  }
+
+  if (tally->mode == TALLY_BUFFERED) {
+    buffer_tally(tally, index, value);
+    return;
+  }
+
+  // Fixed point addition is associative, so the order of updates is irrelevant
+  if (tally->mode == TALLY_REPRODUCIBLE) {
+    const int64_t fixed_value = llrint(value * tally->fixed_scale);
+#pragma omp atomic update
+    tally->fixed_deposition[index] += fixed_value;
+    COUNT_EVENTS(COUNT_TALLY_ATOMICS, 1);
+    return;
+  }
+
+  // Hot cells are accumulated privately, and hits are counted while sampling
+  if (tally->mode == TALLY_HOT) {
+    if (tally->hot_sampling) {
+#pragma omp atomic update
+      tally->hot_slots[index]++;
+      COUNT_EVENTS(COUNT_TALLY_ATOMICS, 1);
+    } else if (tally->hot_slots[index] != TALLY_COLD_CELL) {
+      tally->hot_values[omp_get_thread_num() * tally->hot_stride +
+                        tally->hot_slots[index]] += value;
+      return;
+    }
+  }
+
+#pragma omp atomic update
+  tally->energy_deposition[index] += value;
+  COUNT_EVENTS(COUNT_TALLY_ATOMICS, 1);
+}
+
+// Adds a deposition to the statistical batch of the current history
+inline void batch_tally(Tally* tally, const int index, const double value) {
+  tally->batch_totals[omp_get_thread_num() * tally->batch_stride +
+                      thread_batch] += value;
+
+  const int cellx = index % tally->nx - tally->batch_x0;
+  const int celly = index / tally->nx - tally->batch_y0;
+  if (cellx >= 0 && cellx < tally->batch_nx && celly >= 0 &&
+      celly < tally->batch_ny) {
+#pragma omp atomic update
+    tally->batch_cells[(thread_batch * tally->batch_ny + celly) *
+                           tally->batch_nx +
+                       cellx] += value;
+  }
+}
+
+// Stages a sparse tally update in the thread's direct-mapped staging slots,
+// evicting any other cell that was staged in the same slot
+inline void stage_sparse_tally(Tally* tally, const int index,
+                               const double value) {
+
+  const int slot = omp_get_thread_num() * TALLY_STAGING_ENTRIES +
+                   (index & (TALLY_STAGING_ENTRIES - 1));
+  if (tally->staging_keys[slot] != index) {
+    if (tally->staging_keys[slot] != TALLY_EMPTY_KEY) {
+      add_sparse_tally(tally, tally->staging_keys[slot],
+                       tally->staging_values[slot]);
+    }
+    tally->staging_keys[slot] = index;
+    tally->staging_values[slot] = 0.0;
+  }
+  tally->staging_values[slot] += value;
+}
+
+// Adds to a cell of the sparse tally, claiming a new entry if necessary
+inline void add_sparse_tally(Tally* tally, const int index,
+                             const double value) {
+
+  // Linearly probe from the hashed entry until we find the cell or a gap
+  const int mask = tally->sparse_capacity - 1;
+  int slot = tally_hash(index, tally->sparse_capacity);
+  for (int pp = 0; pp < TALLY_SPARSE_MAX_PROBES; ++pp) {
+    int key;
+#pragma omp atomic read
+    key = tally->sparse_keys[slot];
+
+    // Attempt to claim the empty entry, although another thread may beat us
+    if (key == TALLY_EMPTY_KEY) {
+      key = __sync_val_compare_and_swap(&tally->sparse_keys[slot],
+                                        TALLY_EMPTY_KEY, index);
+      if (key == TALLY_EMPTY_KEY) {
+        key = index;
+#pragma omp atomic update
+        tally->sparse_count++;
+      }
+    }
+
+    if (key == index) {
+#pragma omp atomic update
+      tally->sparse_values[slot] += value;
+      COUNT_EVENTS(COUNT_TALLY_ATOMICS, 1);
+      return;
+    }
+
+    slot = (slot + 1) & mask;
+  }
 
-  const int cellx = particle->cellx - x_off;
-  const int celly = particle->celly - y_off;
+  // The hash map is too full, so fall back to a dense array until the map can
+  // be grown at the end of the timestep
+  double* overflow;
+#pragma omp atomic read
+  overflow = tally->sparse_overflow;
+  if (!overflow) {
+#pragma omp critical(sparse_tally_overflow)
+    {
+      if (!tally->sparse_overflow) {
+        double* new_overflow =
+            (double*)calloc(tally->nx * tally->ny, sizeof(double));
+        if (!new_overflow) {
+          TERMINATE("Could not allocate the sparse tally overflow.\n");
+        }
+#pragma omp atomic write
+        tally->sparse_overflow = new_overflow;
+      }
+      overflow = tally->sparse_overflow;
+    }
+  }
+
+#pragma omp atomic update
+  overflow[index] += value;
+  COUNT_EVENTS(COUNT_TALLY_ATOMICS, 1);
+}
+
+// Holds a deposition in the thread's tally buffer, flushing when it is full
+inline void buffer_tally(Tally* tally, const int index, const double value) {
+  const int tid = omp_get_thread_num();
+  int* count = &tally->buffer_counts[tid * TALLY_BUFFER_STRIDE];
+  if (*count == tally->buffer_size) {
+    flush_tally_buffer(tally, tid);
+  }
+
+  TallyEntry* entry = &tally->buffer[tid * tally->buffer_size + (*count)++];
+  entry->index = index;
+  entry->value = value;
+}
+
+// Orders tally buffer entries by their cell
+int compare_tally_entries(const void* a, const void* b) {
+  return ((const TallyEntry*)a)->index - ((const TallyEntry*)b)->index;
+}
+
+// Sorts a thread's tally buffer by cell and adds each run of depositions into
+// the same cell with a single atomic update, walking the tally in order
+void flush_tally_buffer(Tally* tally, const int tid) {
+  int* count = &tally->buffer_counts[tid * TALLY_BUFFER_STRIDE];
+  if (!*count) {
+    return;
+  }
+
+  TallyEntry* buffer = &tally->buffer[tid * tally->buffer_size];
+  qsort(buffer, *count, sizeof(TallyEntry), compare_tally_entries);
+
+  int nruns = 0;
+  for (int ii = 0; ii < *count;) {
+    const int index = buffer[ii].index;
+    double value = 0.0;
+    for (; ii < *count && buffer[ii].index == index; ++ii) {
+      value += buffer[ii].value;
+    }
 
 #pragma omp atomic update
-  energy_deposition_tally[celly * nx + cellx] +=
-      energy_deposition * inv_ntotal_particles;
+    tally->energy_deposition[index] += value;
+    nruns++;
+  }
+
+  COUNT_EVENTS(COUNT_TALLY_ATOMICS, nruns);
+
+  uint64_t* stats = &tally->buffer_stats[tid * TALLY_BUFFER_STRIDE];
+  stats[0]++;
+  stats[1] += *count;
+  stats[2] += nruns;
+  *count = 0;
+}
+
+// Flushes any deposition that the calling thread is holding back
+inline void flush_tally(Tally* tally) {
+
+  if (tally->mode == TALLY_BUFFERED) {
+    flush_tally_buffer(tally, omp_get_thread_num());
+  }
+
+  if (tally->mode == TALLY_SPARSE) {
+    const int off = omp_get_thread_num() * TALLY_STAGING_ENTRIES;
+    for (int ii = off; ii < off + TALLY_STAGING_ENTRIES; ++ii) {
+      if (tally->staging_keys[ii] != TALLY_EMPTY_KEY) {
+        add_sparse_tally(tally, tally->staging_keys[ii],
+                         tally->staging_values[ii]);
+        tally->staging_keys[ii] = TALLY_EMPTY_KEY;
+        tally->staging_values[ii] = 0.0;
+      }
+    }
+  }
+}
+
+// Fetch the tally cell that a transport cell maps onto, where each tally cell
+// uniformly coarsens a block of the transport mesh
+inline int tally_cell_index(const int x_off, const int y_off,
+                            const int p_cellx, const int p_celly,
+                            const Tally* tally) {
+
+  const int tally_cellx = ((p_cellx - x_off) * tally->nx) / tally->mesh_nx;
+  const int tally_celly = ((p_celly - y_off) * tally->ny) / tally->mesh_ny;
+  return tally_celly * tally->nx + tally_cellx;
 }
 
 // Calculate the distance to the next facet
@@ -505,10 +2047,15 @@ inline double microscopic_cs_for_energy(const CrossSection* cs,
   // Use a simple binary search to find the energy group
   int ind = cs->nentries / 2;
   int width = ind / 2;
+  int depth = 0;
   while (energy < keys[ind] || energy >= keys[ind + 1]) {
     ind += (energy < keys[ind]) ? -width : width;
     width = max(1, width / 2); // To handle odd cases, allows one extra walk
+    depth++;
   }
+  COUNT_EVENTS(COUNT_CS_LOOKUPS, 1);
+  COUNT_EVENTS(COUNT_CS_SEARCH_STEPS, depth);
+  *cs_index = ind;
 
   // Return the value linearly interpolated
   return values[ind] +
@@ -529,6 +2076,9 @@ void validate(const int nx, const int ny, const char* params_filename,
   // Finalise the reduction globally
   double global_energy_tally = reduce_all_sum(local_energy_tally);
 
+  // Compare every cell against the reference tally for the problem
+  validate_tally_cells(nx, ny, params_filename, rank, energy_deposition_tally);
+
   if (rank != MASTER) {
     return;
   }
@@ -567,7 +2117,8 @@ size_t inject_particles(const int nparticles, const int global_nx,
                         const double* edgey, const double initial_energy,
                         Particle** particles) {
 
-  *particles = (Particle*)malloc(sizeof(Particle) * nparticles * 2);
+  *particles = (Particle*)malloc(sizeof(Particle) * nparticles *
+                                 PARTICLE_BANK_FACTOR);
   if (!*particles) {
     TERMINATE("Could not allocate particle array.\n");
   }
@@ -575,58 +2126,160 @@ size_t inject_particles(const int nparticles, const int global_nx,
   START_PROFILING(&compute_profile);
 #pragma omp parallel for
   for (int kk = 0; kk < nparticles; ++kk) {
-    Particle* particle = &(*particles)[kk];
+    initialise_particle(kk, local_nx, local_ny, pad, local_particle_left_off,
+                        local_particle_bottom_off, local_particle_width,
+                        local_particle_height, x_off, y_off, dt, edgex, edgey,
+                        initial_energy, &(*particles)[kk]);
+  }
 
-    double rn[NRANDOM_NUMBERS];
-    generate_random_numbers(kk, 0, 0, &rn[0], &rn[1]);
-
-    // Set the initial nandom location of the particle inside the source
-    // region
-    particle->x = local_particle_left_off + rn[0] * local_particle_width;
-    particle->y = local_particle_bottom_off + rn[1] * local_particle_height;
-
-    // Check the location of the specific cell that the particle sits within.
-    // We have to check this explicitly because the mesh might be non-uniform.
-    int cellx = 0;
-    int celly = 0;
-    for (int ii = 0; ii < local_nx; ++ii) {
-      if (particle->x >= edgex[ii + pad] && particle->x < edgex[ii + pad + 1]) {
-        cellx = x_off + ii;
-        break;
-      }
+  STOP_PROFILING(&compute_profile, "initialising particles");
+
+  return (sizeof(Particle) * nparticles * PARTICLE_BANK_FACTOR);
+}
+
+// Injects the source particles again, reusing the slots of dead particles
+// before growing the particle bank
+void reinject_particles(const int nparticles, const uint64_t first_key,
+                        const int global_nx, const int local_nx,
+                        const int local_ny, const int pad,
+                        const double local_particle_left_off,
+                        const double local_particle_bottom_off,
+                        const double local_particle_width,
+                        const double local_particle_height, const int x_off,
+                        const int y_off, const double dt, const double* edgex,
+                        const double* edgey, const double initial_energy,
+                        int* free_slots, int* nlocal_particles,
+                        Particle* particles) {
+
+  int nthreads = 0;
+#pragma omp parallel
+  { nthreads = omp_get_num_threads(); }
+
+  // Each thread lists the dead slots in its share of the bank, at an offset
+  // found from the counts of the threads before it
+  const int nbank = *nlocal_particles;
+  int nfree = 0;
+  int* thread_nfree = (int*)calloc(nthreads + 1, sizeof(int));
+  if (!thread_nfree) {
+    TERMINATE("Could not allocate the free list offsets.\n");
+  }
+
+#pragma omp parallel
+  {
+    const int tid = omp_get_thread_num();
+    const int begin = (int)(((int64_t)nbank * tid) / nthreads);
+    const int end = (int)(((int64_t)nbank * (tid + 1)) / nthreads);
+
+    int ndead = 0;
+    for (int pp = begin; pp < end; ++pp) {
+      ndead += particles[pp].dead;
     }
-    for (int ii = 0; ii < local_ny; ++ii) {
-      if (particle->y >= edgey[ii + pad] && particle->y < edgey[ii + pad + 1]) {
-        celly = y_off + ii;
-        break;
+    thread_nfree[tid + 1] = ndead;
+
+#pragma omp barrier
+#pragma omp single
+    {
+      for (int ii = 0; ii < nthreads; ++ii) {
+        thread_nfree[ii + 1] += thread_nfree[ii];
       }
+      nfree = thread_nfree[nthreads];
     }
 
-    particle->cellx = cellx;
-    particle->celly = celly;
+    int slot = thread_nfree[tid];
+    for (int pp = begin; pp < end; ++pp) {
+      if (particles[pp].dead) {
+        free_slots[slot++] = pp;
+      }
+    }
+  }
+  free(thread_nfree);
 
-    // Generating theta has uniform density, however 0.0 and 1.0 produce the
-    // same
-    // value which introduces very very very small bias...
-    generate_random_numbers(kk, 0, 1, &rn[0], &rn[1]);
-    const double theta = 2.0 * M_PI * rn[0];
-    particle->omega_x = cos(theta);
-    particle->omega_y = sin(theta);
+  // Particles that do not fit in the free slots grow the bank up to capacity
+  const int capacity = PARTICLE_BANK_FACTOR * nparticles;
+  const int ngrow =
+      (nfree < nparticles) ? min(nparticles - nfree, capacity - nbank) : 0;
+  const int ninject = min(nparticles, nfree) + ngrow;
 
-    // This approximation sets mono-energetic initial state for source
-    // particles
-    particle->energy = initial_energy;
+#pragma omp parallel for
+  for (int kk = 0; kk < ninject; ++kk) {
+    const int pid = (kk < nfree) ? free_slots[kk] : nbank + kk - nfree;
+    initialise_particle(first_key + kk, local_nx, local_ny, pad,
+                        local_particle_left_off, local_particle_bottom_off,
+                        local_particle_width, local_particle_height, x_off,
+                        y_off, dt, edgex, edgey, initial_energy,
+                        &particles[pid]);
+  }
 
-    // Set a weight for the particle to track absorption
-    particle->weight = 1.0;
-    particle->dt_to_census = dt;
-    particle->mfp_to_collision = 0.0;
-    particle->dead = 0;
+  *nlocal_particles = nbank + ngrow;
+  printf("Injected %d particles, %d into free slots\n", ninject,
+         min(nparticles, nfree));
+  if (ninject < nparticles) {
+    printf("Warning: the particle bank is full, %d particles were not "
+           "injected\n",
+           nparticles - ninject);
   }
+}
 
-  STOP_PROFILING(&compute_profile, "initialising particles");
+// Initialises a particle at a random position in the source, where the key
+// selects the particle's random numbers
+void initialise_particle(const uint64_t key, const int local_nx,
+                         const int local_ny, const int pad,
+                         const double local_particle_left_off,
+                         const double local_particle_bottom_off,
+                         const double local_particle_width,
+                         const double local_particle_height, const int x_off,
+                         const int y_off, const double dt, const double* edgex,
+                         const double* edgey, const double initial_energy,
+                         Particle* particle) {
+
+  double rn[NRANDOM_NUMBERS];
+  generate_random_numbers(key, 0, 0, &rn[0], &rn[1]);
+
+  // Set the initial nandom location of the particle inside the source
+  // region
+  particle->x = local_particle_left_off + rn[0] * local_particle_width;
+  particle->y = local_particle_bottom_off + rn[1] * local_particle_height;
+
+  // Check the location of the specific cell that the particle sits within.
+  // We have to check this explicitly because the mesh might be non-uniform.
+  int cellx = 0;
+  int celly = 0;
+  for (int ii = 0; ii < local_nx; ++ii) {
+    if (particle->x >= edgex[ii + pad] && particle->x < edgex[ii + pad + 1]) {
+      cellx = x_off + ii;
+      break;
+    }
+  }
+  for (int ii = 0; ii < local_ny; ++ii) {
+    if (particle->y >= edgey[ii + pad] && particle->y < edgey[ii + pad + 1]) {
+      celly = y_off + ii;
+      break;
+    }
+  }
 
-  return (sizeof(Particle) * nparticles * 2);
+  particle->cellx = cellx;
+  particle->celly = celly;
+
+  // Generating theta has uniform density, however 0.0 and 1.0 produce the
+  // same
+  // value which introduces very very very small bias...
+  generate_random_numbers(key, 0, 1, &rn[0], &rn[1]);
+  const double theta = 2.0 * M_PI * rn[0];
+  particle->omega_x = cos(theta);
+  particle->omega_y = sin(theta);
+
+  // This approximation sets mono-energetic initial state for source
+  // particles
+  particle->energy = initial_energy;
+
+  // Set a weight for the particle to track absorption
+  particle->weight = 1.0;
+  particle->dt_to_census = dt;
+  particle->mfp_to_collision = 0.0;
+  particle->dead = 0;
+  particle->key = key;
+  particle->scatter_cs_index = -1;
+  particle->absorb_cs_index = -1;
 }
 
 void generate_random_numbers(const uint64_t pkey, const uint64_t master_key,
@@ -1,5 +1,56 @@
 #include "../neutral_interface.h"
 
+// Which axis a particle is reflected on when it reaches a region boundary
+enum { NO_REFLECTION, REFLECT_X, REFLECT_Y };
+
+// The state of a history in flight that is not kept in its particle
+typedef struct {
+  Particle* particle;
+  uint64_t pkey;
+  int pid;
+
+  // The local cell, and the cross sections and speed for the particle there
+  int cellx;
+  int celly;
+  int scatter_cs_index;
+  int absorb_cs_index;
+  double local_density;
+  double number_density;
+  double microscopic_cs_scatter;
+  double microscopic_cs_absorb;
+  double macroscopic_cs_scatter;
+  double macroscopic_cs_absorb;
+  double speed;
+  double energy_deposition; // held until the particle leaves the cell
+
+  uint64_t counter;
+  uint64_t first_counter;  // the draws taken before the history was resumed
+  uint64_t nevents;        // the facet and collision events taken
+  uint64_t suspend_events; // the events at which it is suspended, or 0
+
+  int sample_cycles;
+  uint64_t start_cycles;
+  double start_time;
+} History;
+
+// The histories in flight on a thread laid out by lane, so that the next
+// facet of every history can be found in one vectorised pass
+typedef struct {
+  double x[MAX_INTERLEAVE];
+  double y[MAX_INTERLEAVE];
+  double omega_x[MAX_INTERLEAVE];
+  double omega_y[MAX_INTERLEAVE];
+  double speed[MAX_INTERLEAVE];
+  double macroscopic_cs[MAX_INTERLEAVE]; // scatter and absorb together
+  int cellx[MAX_INTERLEAVE];             // padded local cell
+  int celly[MAX_INTERLEAVE];
+
+  double cell_mfp[MAX_INTERLEAVE];
+  double distance_to_facet[MAX_INTERLEAVE];
+  int x_facet[MAX_INTERLEAVE];
+  int reflect[MAX_INTERLEAVE];
+} Lanes;
+
 // Handles the current active batch of particles
 void handle_particles(const int global_nx, const int global_ny, const int nx,
                       const int ny, const uint64_t master_key, const int pad,
@@ -9,10 +60,54 @@ void handle_particles(const int global_nx, const int global_ny, const int nx,
                       const double* edgey, const double* edgedx,
                       const double* edgedy, uint64_t* facets,
                       uint64_t* collisions, const int ntotal_particles,
-                      const int nparticles_to_process,
-                      Particle* particles_start, CrossSection* cs_scatter_table,
-                      CrossSection* cs_absorb_table,
-                      double* energy_deposition_tally);
+                      const int first_particle,
+                      const int nparticles_to_process, Particle* particles,
+                      int* nbanked, uint64_t* nlive,
+                      CrossSection* cs_scatter_table,
+                      CrossSection* cs_absorb_table, const Regions* regions,
+                      Tally* tally,
+                      const VarianceReduction* variance_reduction,
+                      Schedule* schedule, EventCounters* counters,
+                      Tracer* tracer);
+
+// Finds the cost bin of each particle from its starting state
+void bin_histories(const int nx, const int ny, const int pad, const int x_off,
+                   const int y_off, const int nparticles,
+                   const Particle* particles, const double* density,
+                   const Regions* regions, Schedule* schedule);
+
+// Moves the live particles to the front of the bank, keeping their order
+void compact_particles(int* nparticles, Particle* particles);
+
+// Plays roulette with a particle below the weight window of its cell, and
+// splits a particle above the window into copies banked for a later sweep
+int weight_window_event(
+    const int x_off, const int y_off, const uint64_t pkey,
+    const uint64_t master_key, const int ntotal_particles,
+    const double inv_ntotal_particles,
+    const VarianceReduction* variance_reduction, Particle* particle,
+    uint64_t* counter, double* energy_deposition, Tally* tally,
+    Particle* particles, int* nbanked, uint64_t* nsplits);
+
+// Derives the random number key of a secondary from its parent's stream
+uint64_t secondary_key(const uint64_t parent_key, const uint64_t counter,
+                       const int copy);
+
+// Stages a secondary in the block of the bank reserved by the calling thread,
+// reserving a new block when it is full, and returns 0 if the bank is full
+int stage_secondary(const Particle* secondary, Particle* particles,
+                    int* nbanked, const int capacity);
+
+// Marks the unused slots of the calling thread's reserved block as dead
+void release_secondaries(Particle* particles);
+
+// Suspends a history that has used its event budget at the tail of the ring
+void suspend_history(Schedule* schedule, const int pid, const uint64_t counter,
+                     const uint64_t nevents, const double seconds);
+
+// Resumes a suspended history once the calling thread has finished its last
+// history, returning 0 when no thread is left that could suspend another
+int resume_history(Schedule* schedule, SuspendedHistory* resumed);
 
 // Handle facet event
 int facet_event(const int global_nx, const int global_ny, const int nx,
@@ -24,35 +119,96 @@ int facet_event(const int global_nx, const int global_ny, const int nx,
                 double* energy_deposition, double* number_density,
                 double* microscopic_cs_scatter, double* microscopic_cs_absorb,
                 double* macroscopic_cs_scatter, double* macroscopic_cs_absorb,
-                double* energy_deposition_tally, int* cellx, int* celly,
-                double* local_density);
+                Tally* tally, int* cellx, int* celly, double* local_density);
 
 // Handles a collision event
 int collision_event(
-    const int global_nx, const int nx, const int x_off, const int y_off,
-    const uint64_t pkey, const uint64_t master_key,
-    const double inv_ntotal_particles, const double distance_to_collision,
-    const double local_density, const CrossSection* cs_scatter_table,
-    const CrossSection* cs_absorb_table, Particle* particle, uint64_t* counter,
-    double* energy_deposition, double* number_density,
-    double* microscopic_cs_scatter, double* microscopic_cs_absorb,
-    double* macroscopic_cs_scatter, double* macroscopic_cs_absorb,
-    double* energy_deposition_tally, int* scatter_cs_index,
+    const int global_nx, const int global_ny, const int nx, const int pad,
+    const int x_off, const int y_off, const uint64_t pkey,
+    const uint64_t master_key, const double inv_ntotal_particles,
+    const double distance_to_collision, const double local_density,
+    const CrossSection* cs_scatter_table, const CrossSection* cs_absorb_table,
+    const Regions* regions, const double* edgex, const double* edgey,
+    Particle* particle, uint64_t* counter, double* energy_deposition,
+    double* number_density, double* microscopic_cs_scatter,
+    double* microscopic_cs_absorb, double* macroscopic_cs_scatter,
+    double* macroscopic_cs_absorb, Tally* tally,
+    const VarianceReduction* variance_reduction, int* scatter_cs_index,
     int* absorb_cs_index, double rn[NRANDOM_NUMBERS], double* speed);
 
-void census_event(const int global_nx, const int nx, const int x_off,
-                  const int y_off, const double inv_ntotal_particles,
+void census_event(const int global_nx, const int global_ny, const int nx,
+                  const int pad, const int x_off, const int y_off,
+                  const double inv_ntotal_particles,
                   const double distance_to_census, const double cell_mfp,
-                  Particle* particle, double* energy_deposition,
-                  double* number_density, double* microscopic_cs_scatter,
-                  double* microscopic_cs_absorb,
-                  double* energy_deposition_tally);
+                  const Regions* regions, const double* edgex,
+                  const double* edgey, Particle* particle,
+                  double* energy_deposition, double* number_density,
+                  double* microscopic_cs_scatter, double* microscopic_cs_absorb,
+                  Tally* tally);
+
+// Handles a particle crossing the boundary between two regions
+int region_event(const int global_nx, const int global_ny, const int nx,
+                 const int pad, const int x_off, const int y_off,
+                 const double inv_ntotal_particles,
+                 const double distance_to_boundary, const double speed,
+                 const double cell_mfp, const int reflect,
+                 const Regions* regions, const double* edgex,
+                 const double* edgey, Particle* particle,
+                 double* energy_deposition, double* number_density,
+                 double* microscopic_cs_scatter, double* microscopic_cs_absorb,
+                 double* macroscopic_cs_scatter, double* macroscopic_cs_absorb,
+                 Tally* tally, double* local_density);
+
+// Accumulates the energy deposited along a path, splitting it over the cells
+// that the path crosses when tracking against region boundaries
+void deposit_energy_along_path(
+    const int global_nx, const int global_ny, const int nx, const int pad,
+    const int x_off, const int y_off, const double inv_ntotal_particles,
+    const double path_length, const double number_density,
+    const double microscopic_cs_absorb, const double microscopic_cs_total,
+    const Regions* regions, const double* edgex, const double* edgey,
+    Particle* particle, double* energy_deposition, Tally* tally);
+
+// Calculate the distance to the next region boundary, or to the edge of the
+// domain where the particle will be reflected
+void calc_distance_to_region_boundary(const Regions* regions, const double x,
+                                      const double y, const double omega_x,
+                                      const double omega_y,
+                                      double* distance_to_boundary,
+                                      int* reflect);
+
+// Fetch the density of the region containing a point
+double region_density(const Regions* regions, const double x, const double y);
 
 // Tallies the energy deposition in the cell
-void update_tallies(const int nx, const int x_off, const int y_off,
-                    Particle* particle, const double inv_ntotal_particles,
-                    const double energy_deposition,
-                    double* energy_deposition_tally);
+void update_tallies(const int x_off, const int y_off, const int p_cellx,
+                    const int p_celly, const double inv_ntotal_particles,
+                    const double energy_deposition, Tally* tally);
+
+// Adds a deposition to the statistical batch of the current history
+void batch_tally(Tally* tally, const int index, const double value);
+
+// Stages a sparse tally update in the thread's direct-mapped staging slots
+void stage_sparse_tally(Tally* tally, const int index, const double value);
+
+// Adds to a cell of the sparse tally, claiming a new entry if necessary
+void add_sparse_tally(Tally* tally, const int index, const double value);
+
+// Holds a deposition in the thread's tally buffer, flushing when it is full
+void buffer_tally(Tally* tally, const int index, const double value);
+
+// Sorts a thread's tally buffer by cell and merges it into the tally
+void flush_tally_buffer(Tally* tally, const int tid);
+
+// Orders tally buffer entries by their cell
+int compare_tally_entries(const void* a, const void* b);
+
+// Flushes any deposition that the calling thread is holding back
+void flush_tally(Tally* tally);
+
+// Fetch the tally cell that a transport cell maps onto
+int tally_cell_index(const int x_off, const int y_off, const int p_cellx,
+                     const int p_celly, const Tally* tally);
 
 // Handle the collision event, including absorption and scattering
 int handle_collision(Particle* particle, const double macroscopic_cs_absorb,
@@ -82,5 +238,17 @@ double calculate_energy_deposition(
 double microscopic_cs_for_energy(const CrossSection* cs, const double energy,
                                  int* cs_index);
 
+// Initialises a particle at a random position in the source, where the key
+// selects the particle's random numbers
+void initialise_particle(const uint64_t key, const int local_nx,
+                         const int local_ny, const int pad,
+                         const double local_particle_left_off,
+                         const double local_particle_bottom_off,
+                         const double local_particle_width,
+                         const double local_particle_height, const int x_off,
+                         const int y_off, const double dt, const double* edgex,
+                         const double* edgey, const double initial_energy,
+                         Particle* particle);
+
 void generate_random_numbers(const uint64_t pkey, const uint64_t master_key,
                              const uint64_t counter, double* rn0, double* rn1);
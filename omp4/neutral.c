@@ -16,20 +16,41 @@
 #endif
 
 // Performs a solve of dependent variables for particle transport
-void solve_transport_2d(
+int solve_transport_2d(
     const int nx, const int ny, const int global_nx, const int global_ny,
     const uint64_t master_key, const int pad, const int x_off, const int y_off,
     const double dt, const int ntotal_particles, int* nparticles,
     const int* neighbours, Particle* particles, const double* density,
     const double* edgex, const double* edgey, const double* edgedx,
     const double* edgedy, CrossSection* cs_scatter_table,
-    CrossSection* cs_absorb_table, double* energy_deposition_tally,
-    uint64_t* reduce_array0, uint64_t* reduce_array1, uint64_t* reduce_array2,
-    uint64_t* facet_events, uint64_t* collision_events) {
+    CrossSection* cs_absorb_table, const Regions* regions, Tally* tally,
+    const VarianceReduction* variance_reduction, Schedule* schedule,
+    EventCounters* counters, Tracer* tracer, uint64_t* reduce_array0,
+    uint64_t* reduce_array1, uint64_t* reduce_array2, uint64_t* facet_events,
+    uint64_t* collision_events) {
+
+  // These kernels tally directly onto a dense transport mesh
+  if (tally->mode != TALLY_DENSE || tally->nx != nx || tally->ny != ny) {
+    TERMINATE("Only a dense tally on the transport mesh is supported.\n");
+  }
+  if (variance_reduction->weight_cutoff > 0.0 ||
+      variance_reduction->window_lower || variance_reduction->window_output) {
+    TERMINATE("Roulette and weight windows are only supported by omp3.\n");
+  }
+  if (schedule->lpt) {
+    TERMINATE("Ordering histories by cost is only supported by omp3.\n");
+  }
+  if (schedule->event_budget) {
+    TERMINATE("Suspending histories is only supported by omp3.\n");
+  }
+  if (schedule->interleave > 1 || schedule->lockstep) {
+    TERMINATE("Interleaving histories is only supported by omp3.\n");
+  }
+  double* energy_deposition_tally = tally->energy_deposition;
 
   if (!(*nparticles)) {
     printf("Out of particles\n");
-    return;
+    return 0;
   }
 
   handle_particles(global_nx, global_ny, nx, ny, master_key, pad, x_off, y_off,
@@ -37,6 +58,9 @@ void solve_transport_2d(
                    facet_events, collision_events, ntotal_particles,
                    *nparticles, particles, cs_scatter_table, cs_absorb_table,
                    energy_deposition_tally);
+
+  // Deaths are not counted by these kernels, so every particle may be alive
+  return *nparticles;
 }
 
 // Handles the current active batch of particles
@@ -587,6 +611,15 @@ void validate(const int nx, const int ny, const char* params_filename,
   // Finalise the reduction globally
   double global_energy_tally = reduce_all_sum(local_energy_tally);
 
+  // Compare every cell against the reference tally for the problem
+  double* h_energy_deposition_tally;
+  allocate_host_data(&h_energy_deposition_tally, nx * ny);
+  copy_buffer(nx * ny, &energy_deposition_tally, &h_energy_deposition_tally,
+              RECV);
+  validate_tally_cells(nx, ny, params_filename, rank,
+                       h_energy_deposition_tally);
+  deallocate_host_data(h_energy_deposition_tally);
+
   if (rank != MASTER) {
     return;
   }
@@ -711,3 +744,18 @@ size_t inject_particles(const int nparticles, const int global_nx,
   return allocation;
 }
 
+// Injecting the source each timestep is only supported by omp3
+void reinject_particles(const int nparticles, const uint64_t first_key,
+                        const int global_nx, const int local_nx,
+                        const int local_ny, const int pad,
+                        const double local_particle_left_off,
+                        const double local_particle_bottom_off,
+                        const double local_particle_width,
+                        const double local_particle_height, const int x_off,
+                        const int y_off, const double dt, const double* edgex,
+                        const double* edgey, const double initial_energy,
+                        int* free_slots, int* nlocal_particles,
+                        Particle* particles) {
+  TERMINATE("Injecting the source each timestep is only supported by omp3.\n");
+}
+